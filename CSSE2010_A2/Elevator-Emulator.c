@@ -10,21 +10,6 @@
 /* Definitions */
 
 #define F_CPU 8000000L
-#define BUZZER_DDR DDRD
-#define BUZZER_PORT PORTD
-#define BUZZER_PIN PC7
-
-#define SEG_A (1<<PA0)
-#define SEG_B (1<<PA1)
-#define SEG_C (1<<PA2)
-#define SEG_D (1<<PA3)
-#define SEG_E (1<<PA4)
-#define SEG_F (1<<PA5)
-#define SEG_G (1<<PA6)
-#define SEG_MASK (SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G)
-
-#define SSD_CC (1<<PD2)
-#define SSD_DP (1<<PD3)
 
 #define LED_L0 (1<<PC4)
 #define LED_L1 (1<<PC5)
@@ -32,6 +17,10 @@
 #define LED_L3 (1<<PC7)
 #define LED_MASK (LED_L0|LED_L1|LED_L2|LED_L3)
 
+// How late (ms) a step of the cars can finish (and start, for the step
+// monitor)
+#define MOVE_DEADLINE 5
+
 
 
 /* External Library Includes */
@@ -40,6 +29,7 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <util/delay.h>
 #include <stdbool.h>
 
@@ -48,42 +38,81 @@
 #include "display.h"
 #include "ledmatrix.h"
 #include "buttons.h"
+#include "buzzer.h"
+#include "command.h"
+#include "controller.h"
+#include "inputs.h"
+#include "serial1.h"
 #include "serialio.h"
+#include "statusview.h"
+#include "scheduler.h"
+#include "ssd.h"
+#include "stepmonitor.h"
+#include "telemetry.h"
 #include "terminalio.h"
 #include "timer0.h"
 
 /* Data Structures */
 
-typedef enum {UNDEF_FLOOR = -1, FLOOR_0=0, FLOOR_1=4, FLOOR_2=8, FLOOR_3=12} ElevatorFloor;
-
-uint8_t floor_seg[4] = {
+uint8_t digit_seg[10] = {
 	SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F,    // 0
 	SEG_B|SEG_C,                            // 1
 	SEG_A|SEG_B|SEG_D|SEG_E|SEG_G,          // 2
-	SEG_A|SEG_B|SEG_C|SEG_D|SEG_G           // 3
+	SEG_A|SEG_B|SEG_C|SEG_D|SEG_G,          // 3
+	SEG_B|SEG_C|SEG_F|SEG_G,                // 4
+	SEG_A|SEG_C|SEG_D|SEG_F|SEG_G,          // 5
+	SEG_A|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G,    // 6
+	SEG_A|SEG_B|SEG_C,                      // 7
+	SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G, // 8
+	SEG_A|SEG_B|SEG_C|SEG_D|SEG_F|SEG_G     // 9
 };
 
+// Rows of the playing field - the top floor has room above it for a car
+#define FIELD_HEIGHT (NUM_FLOORS * FLOOR_HEIGHT)
+
 /* Global Variables */
-uint32_t time_since_move;
-ElevatorFloor current_position;
-ElevatorFloor destination;
-ElevatorFloor current_floor;
-ElevatorFloor traveller_dest;
-ElevatorFloor last_traveller_floor = UNDEF_FLOOR;
-const char *direction;
 bool moved = false;
-bool traveller_present = false;
-bool traveller_onboard = false;
-ElevatorFloor traveller_floor;
 uint16_t speed;
 uint8_t last_direction = SEG_G;
-uint32_t floors_with_traveller    = 0;
-uint32_t floors_without_traveller = 0;
+uint8_t move_task;
+
+// Terminal status screen fields
+uint8_t level_field;
+uint8_t direction_field;
+uint8_t with_traveller_field;
+uint8_t without_traveller_field;
+uint8_t policy_field;
+uint8_t waiting_field;
+uint8_t journeys_field;
+uint8_t throughput_field;
+uint8_t wait_field;
+uint8_t car_journeys_field;
+uint8_t idle_field;
+uint8_t dropped_field;
+uint8_t step_bytes_field;
+
+const char policy_look[] PROGMEM = "LOOK";
+const char policy_scan[] PROGMEM = "SCAN";
+const char policy_nearest[] PROGMEM = "Nearest";
+PGM_P const policy_names[NUM_POLICIES] PROGMEM = {
+	policy_look, policy_scan, policy_nearest
+};
 
 
 
 #define TRAVELLER_COLUMN 4
 
+// Left hand column of each car (cars are 2 LEDs wide)
+#if NUM_CARS == 1
+uint8_t car_column[NUM_CARS] = {1};
+#elif NUM_CARS == 2
+uint8_t car_column[NUM_CARS] = {1, 5};
+#elif NUM_CARS == 3
+uint8_t car_column[NUM_CARS] = {0, 2, 5};
+#else
+#error "Only 1 to 3 cars fit on the LED matrix"
+#endif
+
 bool led_animating = false;
 uint32_t led_anim_start = 0;
 
@@ -97,22 +126,25 @@ void service_led_animation(void) {
 
 	uint32_t dt = get_current_time() - led_anim_start;
 	
-	PORTC &= ~LED_MASK;
-
-
+	uint8_t leds;
 	if (dt < 400) { //door closed
-        PORTC |= (LED_L1|LED_L2);
+		leds = LED_L1|LED_L2;
 	}
 	else if (dt < 800) { // door open
-        PORTC |= (LED_L0|LED_L3);
+		leds = LED_L0|LED_L3;
 	}
 	else if (dt < 1200) { //door closing
-        PORTC |= (LED_L1|LED_L2);
+		leds = LED_L1|LED_L2;
 	}
 	else {
 		led_animating = false; //door close
-        PORTC |= (LED_L1|LED_L2);
+		leds = LED_L1|LED_L2;
 	}
+	
+	// The seven segment display's interrupt also writes port C
+	cli();
+	PORTC = (PORTC & ~LED_MASK) | leds;
+	sei();
 }
 
 
@@ -122,10 +154,19 @@ void service_led_animation(void) {
 void initialise_hardware(void);
 void start_screen(void);
 void start_elevator_emulator(void);
-void handle_inputs(void);
+void handle_input(const InputEvent* event);
+void handle_key(char key, uint32_t time);
+void handle_button(const ButtonEvent* event);
+void hall_call_from_inputs(uint8_t origin, uint32_t time);
 void draw_elevator(void);
 void draw_floors(void);
 void draw_traveller(void);
+void draw_row(uint16_t y);
+void follow_car(void);
+uint8_t lowest_visible_floor(void);
+void handle_controller_event(const ControllerEvent* event);
+void show_status(void);
+void lay_out_status(void);
 uint16_t get_speed(void);
 
 
@@ -146,24 +187,6 @@ int main(void) {
 /* Internal Function Definitions */
 
 
-static void beep(uint16_t freq, uint16_t dur_ms)
-{
-	OCR1A   = F_CPU/(16UL*freq) - 1;
-	TCNT1   = 0;
-	TCCR1A  = 0;
-	TCCR1B  = (1<<WGM12) | (1<<CS11);
-
-	uint32_t count = (uint32_t)freq * dur_ms * 2UL / 1000UL;
-	while (count--) {
-		while (!(TIFR1 & (1<<OCF1A)));
-		TIFR1        = (1<<OCF1A);
-		BUZZER_PORT ^= (1<<BUZZER_PIN);
-	}
-	TCCR1B = 0;
-	BUZZER_PORT &= ~(1<<BUZZER_PIN);
-}
-
-
 /**
  * @brief All hardware initialisation occurs here
  * @arg none
@@ -172,26 +195,21 @@ static void beep(uint16_t freq, uint16_t dur_ms)
 void initialise_hardware(void) {
 	
 	ledmatrix_setup();
-	init_button_interrupts();
 	// Setup serial port for 19200 baud communication with no echo
 	// of incoming characters
 	init_serial_stdio(19200,0);
+	init_serial1(SERIAL1_BAUD);
 	
 	init_timer0();
-	
-	// Turn on global interrupts
-	sei();
-	
-	DDRA |= SEG_MASK;
-	PORTA &= ~SEG_MASK;
-
-	DDRD |= SSD_CC | SSD_DP;
-	PORTD |=  SSD_CC;
-	PORTD &= ~SSD_DP;
-	BUZZER_DDR |= (1<<BUZZER_PIN);
+	init_inputs();
+	init_ssd();
+	init_buzzer();
 	
 	DDRC |= LED_MASK;
 	PORTC &= ~LED_MASK;
+	
+	// Turn on global interrupts
+	sei();
 
 }
 
@@ -257,42 +275,109 @@ void start_screen(void) {
 		if (btn != NO_BUTTON_PUSHED) {
 			break;
 		}
+		
+		// Sleep until the next frame, a key or a button
+		idle_until(doors_frame_time + interval_delay + 1);
 	}
 }
 
-static void multiplex_ssd(void) {
-	static uint32_t last_t = 0;
-	static bool show_floor = false;
-	uint32_t now = get_current_time();
-	if (now == last_t) return;
-	last_t = now;
-	show_floor = !show_floor;
+// Shows car 0 on the seven segment display - its floor on the right, with
+// the decimal point lit between floors, and its direction on the left.
+// Floors above 9 need the left digit for the tens, so the direction is only
+// shown below that.
+static void update_ssd(void) {
+	const Car* car = controller_car(0);
+	ssd_set_digit(SSD_RIGHT, digit_seg[car->floor % 10],
+			car->position % FLOOR_HEIGHT != 0);
+	ssd_set_digit(SSD_LEFT, car->floor >= 10 ? digit_seg[car->floor / 10] :
+			last_direction, 0);
+}
 
-	if (show_floor) {
-		PORTD |= SSD_CC;
-		} else {
-		PORTD &= ~SSD_CC;
-	}
+/* Tasks run by the scheduler from start_elevator_emulator() */
 
-	PORTA &= ~SEG_MASK;
-	PORTD &= ~SSD_DP;
+// Steps the cars and redraws them
+static void move_cars(uint32_t release) {
+	step_monitor_record(release, speed);
+	controller_step(release);
+	follow_car();
+	
+	uint8_t next_seg = SEG_G;
+	if (controller_car(0)->last_move == DIRECTION_UP) {
+		next_seg = SEG_A;
+	} else if (controller_car(0)->last_move == DIRECTION_DOWN) {
+		next_seg = SEG_D;
+	}
+	last_direction = next_seg;
+	update_ssd();
+	
+	draw_elevator();
+	moved = true;
+	
+	// Calls that commands gave a time that has now come
+	command_poll(release);
+	
+	// Steps are every 100 or 250 ms, depending on the speed switch. They
+	// stay on the grid of release times, however long this one took.
+	speed = get_speed();
+	scheduler_set_period(move_task, speed);
+}
 
-	if (show_floor) {
-		uint8_t f = current_floor / 4;
-		PORTA |= floor_seg[f];
-		if (current_position % 4 != 0) {
-			PORTD |= SSD_DP;
-		}
-		//right
-		PORTD &= ~SSD_CC;
-		} else {
-		PORTA |= last_direction;  
-		//left
-		PORTD |= SSD_CC;
+// Triggered by the input interrupt handlers (see inputs.h) - reads every
+// event waiting, so it only runs when there is input
+static void read_inputs(uint32_t release) {
+	(void)release;
+	InputEvent event;
+	while (input_get(&event)) {
+		handle_input(&event);
 	}
 }
 
+static void animate_leds(uint32_t release) {
+	(void)release;
+	service_led_animation();
+}
+
+// Sends any squares that have changed colour to the LED matrix
+static void flush_ledmatrix(uint32_t release) {
+	(void)release;
+	ledmatrix_flush();
+}
+
+// The status screen is the least important output, so it is dropped
+// rather than waiting when the terminal can't keep up
+static void update_status(uint32_t release) {
+	(void)release;
+	if (moved) {
+		uint8_t policy = serial_set_output_policy(SERIAL_DROP_NEWEST);
+		show_status();
+		serial_set_output_policy(policy);
+		moved = false;
+	}
+}
 
+/**
+ * @brief Clears the serial terminal and prints the labels of the status
+ * screen
+ * @arg none
+ * @retval none
+*/
+void lay_out_status(void) {
+	clear_terminal();
+	statusview_init();
+	level_field = statusview_add_field(10, 10, PSTR("Current Level: "));
+	direction_field = statusview_add_field(10, 12, PSTR("Direction: "));
+	with_traveller_field = statusview_add_field(10, 14, PSTR("Floors with traveller: "));
+	without_traveller_field = statusview_add_field(10, 16, PSTR("Floors without traveller: "));
+	policy_field = statusview_add_field(10, 18, PSTR("Policy: "));
+	waiting_field = statusview_add_field(10, 20, PSTR("Waiting/riding: "));
+	journeys_field = statusview_add_field(10, 22, PSTR("Journeys: "));
+	throughput_field = statusview_add_field(10, 24, PSTR("Journeys/min: "));
+	wait_field = statusview_add_field(10, 26, PSTR("Average wait (s): "));
+	car_journeys_field = statusview_add_field(10, 28, PSTR("Journeys by car: "));
+	idle_field = statusview_add_field(10, 30, PSTR("CPU idle (%): "));
+	dropped_field = statusview_add_field(10, 32, PSTR("Serial dropped: "));
+	step_bytes_field = statusview_add_field(10, 34, PSTR("Serial bytes/step: "));
+}
 
 /**
  * @brief Initialises LED matrix and then starts infinite loop handling elevator
@@ -301,287 +386,423 @@ static void multiplex_ssd(void) {
 */
 void start_elevator_emulator(void) {
 	
-	// Clear the serial terminal
-	clear_terminal();
+	// Clear the serial terminal and lay out the status screen
+	lay_out_status();
+	command_init(10, 36);
 	
 	// Initialise Display
 	initialise_display();
 	
-	// Clear a button push or serial input if any are waiting
-	// (The cast to void means the return value is ignored.)
-	(void)button_pushed();
+	// Clear button pushes or serial input if any are waiting
+	clear_button_events();
 	clear_serial_input_buffer();
 
-	time_since_move = get_current_time();
-	
-	current_position = FLOOR_0;
-	destination      = FLOOR_0;
-	current_floor    = FLOOR_0;
-	direction        = "Stationary";
-	moved            = true;
-	traveller_dest = UNDEF_FLOOR;
-	last_traveller_floor = UNDEF_FLOOR;
-
+	moved = true;
+	speed = get_speed();
 	
+	controller_init(get_current_time());
+	controller_set_event_handler(handle_controller_event);
+	telemetry_init();
 	
 	// Draw the floors and elevator
 	draw_elevator();
 	draw_floors();
-	
-	current_position = FLOOR_0;
-	destination = FLOOR_0;
-	
+	update_ssd();
+	
+	// Everything else happens in the tasks below, most urgent first. The
+	// cars step every speed ms, on absolute release times. Input is
+	// read when there is some, rather than on a period. (The tasks are
+	// numbered in the order they are added, e.g. for the :Q command.)
+	scheduler_init();
+	scheduler_set_miss_handler(telemetry_deadline_miss);
+	move_task = scheduler_add_task(move_cars, speed, MOVE_DEADLINE, 0);
+	step_monitor_init(MOVE_DEADLINE);
+	inputs_start(scheduler_add_task(read_inputs, 0, 20, 1));
+	scheduler_add_task(animate_leds, 10, 10, 2);
+	scheduler_add_task(flush_ledmatrix, 2, 10, 3);
+	scheduler_add_task(update_status, 50, 100, 4);
+	
+	// Sleep whenever nothing is due
 	while(true) {
-        multiplex_ssd();
-		service_led_animation();
-
-
-		speed = get_speed(); 
-		
-		// Only update the elevator every 200 ms
-		if (get_current_time() - time_since_move > speed) {	
-			uint8_t next_seg = SEG_G;
-
-
-			if (destination > current_position) { // Move up
-				current_position++;
-				moved     = true;
-				direction = "Up";
-				next_seg  = SEG_A;
-				if (current_position % 4 == 0) {
-					current_floor = current_position;
-					if (traveller_onboard) {
-						floors_with_traveller++;
-						} else {
-						floors_without_traveller++;
-					}
-				}
-			}
-			else if (destination < current_position) { // Move down
-				current_position--;
-				moved     = true;
-				direction = "Down";
-				next_seg  = SEG_D;
-				if (current_position % 4 == 0) {
-					current_floor = current_position;
-					if (traveller_onboard) {
-						floors_with_traveller++;
-						} else {
-						floors_without_traveller++;
-					}
-				}
-			}
-			
-			if (traveller_present && current_position == traveller_floor) {
-				traveller_present = false;
-				traveller_onboard = true;  
-				destination = traveller_dest;
-				traveller_dest = UNDEF_FLOOR;
-				draw_traveller();
-				beep(500, 100);
-				
-				start_led_animation(); 
-
-			}
-			
-			if (traveller_onboard && current_position == destination) {
-				traveller_onboard = false;
-				beep(500, 100);
-				
-				start_led_animation();
-
-			}
-
-			
-			if (next_seg != last_direction) {
-				last_direction = next_seg;
-				// update left digit
-				PORTA = (PORTA & ~SEG_MASK) | last_direction;
-			}
-			
-			draw_elevator();
-			
-			time_since_move = get_current_time(); // Reset delay until next movement update
+		if (!scheduler_run_once()) {
+			scheduler_idle();
 		}
-		if (moved) {
-			clear_terminal();
-			uint8_t floor_num = current_floor / 4;
-
-			move_terminal_cursor(10,10);
-			printf("Current Level: %d", floor_num);
-
-			move_terminal_cursor(10,12);
-			printf("Direction: %s", direction);
-
-			move_terminal_cursor(10,14);
-			printf("Floors with traveller: %lu", floors_with_traveller);
+	}
+}
 
-			move_terminal_cursor(10,16);
-			printf("Floors without traveller: %lu", floors_without_traveller);
+/**
+ * @brief Reacts to the elevator controller picking up and dropping off travellers
+ * @arg event - what happened
+ * @retval none
+*/
+void handle_controller_event(const ControllerEvent* event) {
+	telemetry_controller_event(event);
+	switch (event->type) {
+		case EVENT_HALL_CALL:
+			buzzer_play(tune_chirp);
+			draw_traveller();
+			break;
+		case EVENT_PICKUP:
+			draw_traveller();
+			// fall through
+		case EVENT_DROPOFF:
+			buzzer_play(tune_arrival);
+			start_led_animation();
+			break;
+		default:
+			break;
+	}
+}
 
-			moved = false;
+/**
+ * @brief Updates the terminal status screen. Only the characters that have
+ * changed are sent.
+ * @arg none
+ * @retval none
+*/
+void show_status(void) {
+	const ControllerStats* stats = controller_stats();
+	
+	// Fields with a value for each car, separated by spaces
+	char levels[STATUSVIEW_FIELD_WIDTH + 1];
+	char directions[STATUSVIEW_FIELD_WIDTH + 1];
+	char car_journeys[STATUSVIEW_FIELD_WIDTH + 1];
+	uint8_t levels_length = 0;
+	uint8_t directions_length = 0;
+	uint8_t car_journeys_length = 0;
+	uint32_t floors_with_traveller = 0;
+	uint32_t floors_without_traveller = 0;
+	uint8_t riders = 0;
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		const Car* car = controller_car(c);
+		PGM_P direction = PSTR("Stop");
+		if (car->last_move == DIRECTION_UP) {
+			direction = PSTR("Up");
+		} else if (car->last_move == DIRECTION_DOWN) {
+			direction = PSTR("Down");
 		}
+		levels_length += snprintf_P(levels + levels_length,
+				sizeof(levels) - levels_length, PSTR("%d "), car->floor);
+		directions_length += snprintf_P(directions + directions_length,
+				sizeof(directions) - directions_length, PSTR("%S "), direction);
+		car_journeys_length += snprintf_P(car_journeys + car_journeys_length,
+				sizeof(car_journeys) - car_journeys_length, PSTR("%" PRIu32 " "),
+				car->journeys);
+		if (levels_length >= sizeof(levels)) levels_length = sizeof(levels) - 1;
+		if (directions_length >= sizeof(directions)) directions_length = sizeof(directions) - 1;
+		if (car_journeys_length >= sizeof(car_journeys)) car_journeys_length = sizeof(car_journeys) - 1;
+		floors_with_traveller += car->floors_with_traveller;
+		floors_without_traveller += car->floors_without_traveller;
+		riders += car->num_riders;
+	}
+	statusview_set_value(level_field, levels);
+	statusview_set_value(direction_field, directions);
+	statusview_set_value(car_journeys_field, car_journeys);
+	statusview_printf_P(with_traveller_field, PSTR("%" PRIu32), floors_with_traveller);
+	statusview_printf_P(without_traveller_field, PSTR("%" PRIu32), floors_without_traveller);
+	statusview_printf_P(policy_field, PSTR("%S"),
+			(PGM_P)pgm_read_ptr(&policy_names[controller_policy()]));
+	statusview_printf_P(waiting_field, PSTR("%d/%d"),
+			controller_num_waiting(), riders);
+	statusview_printf_P(journeys_field, PSTR("%" PRIu32), stats->journeys);
+	
+	// Completed journeys per minute since the emulator started, in tenths.
+	// Elapsed time is in units of 100 ms to keep the product within 32 bits.
+	uint32_t elapsed = (get_current_time() - stats->start_time) / 100;
+	uint32_t per_minute = 0;
+	if (elapsed > 0) {
+		per_minute = stats->journeys * 6000 / elapsed;
+	}
+	statusview_printf_P(throughput_field, PSTR("%" PRIu32 ".%" PRIu32),
+			per_minute / 10, per_minute % 10);
 	
-		handle_inputs();
+	// Average call to pickup time, in tenths of a second
+	uint32_t pickups = stats->journeys;
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		pickups += controller_car(c)->num_riders;
+	}
+	uint32_t average_wait = 0;
+	if (pickups > 0) {
+		average_wait = stats->total_wait / pickups / 100;
 	}
+	statusview_printf_P(wait_field, PSTR("%" PRIu32 ".%" PRIu32),
+			average_wait / 10, average_wait % 10);
+	statusview_printf_P(idle_field, PSTR("%d"), get_idle_percent());
+	statusview_printf_P(dropped_field, PSTR("%" PRIu32),
+			serial_dropped(SERIAL_DROP_NEWEST));
+	// Last, most and average per step, up to the step before this one
+	statusview_printf_P(step_bytes_field, PSTR("%u/%u/%u"),
+			statusview_last_step_bytes(), statusview_max_step_bytes(),
+			statusview_average_step_bytes());
+	statusview_measure_step();
 }
 
 /**
- * @brief Draws 4 lines of "FLOOR" coloured pixels
+ * @brief Draws a line of "FLOOR" coloured pixels for each floor
  * @arg none
  * @retval none
 */
 void draw_floors(void) {
 	for (uint8_t i = 0; i < WIDTH; i++) {
-		update_square_colour(i, FLOOR_0, FLOOR);
-		update_square_colour(i, FLOOR_1, FLOOR);
-		update_square_colour(i, FLOOR_2, FLOOR);
-		update_square_colour(i, FLOOR_3, FLOOR);
+		for (uint8_t floor = 0; floor < NUM_FLOORS; floor++) {
+			update_square_colour(i, floor * FLOOR_HEIGHT, FLOOR);
+		}
 	}
 }
 
+/**
+ * @brief Shows the longest waiting traveller at each floor, coloured by
+ * where they want to go (the colours repeat every 4 floors)
+ * @arg none
+ * @retval none
+*/
 void draw_traveller(void) {
-	if (last_traveller_floor != UNDEF_FLOOR) {
-		int prev_row = last_traveller_floor + 1;
-		update_square_colour(TRAVELLER_COLUMN, prev_row, EMPTY_SQUARE);
-	}
-	if (traveller_present) {
-		int row = traveller_floor + 1;
-		uint8_t obj;
-		switch (traveller_dest) {
-			case FLOOR_0: obj = TRAVELLER_TO_0; break;
-			case FLOOR_1: obj = TRAVELLER_TO_1; break;
-			case FLOOR_2: obj = TRAVELLER_TO_2; break;
-			case FLOOR_3: obj = TRAVELLER_TO_3; break;
-			default:      obj = TRAVELLER_TO_0; break;
+	for (uint8_t floor = 0; floor < NUM_FLOORS; floor++) {
+		uint8_t destination = controller_waiting_destination(floor);
+		uint8_t obj = EMPTY_SQUARE;
+		if (destination != NO_FLOOR) {
+			obj = TRAVELLER_TO_0 + destination % 4;
 		}
-		update_square_colour(TRAVELLER_COLUMN, row, obj);
-		last_traveller_floor = traveller_floor;
-		} else {
-		last_traveller_floor = UNDEF_FLOOR;
+		update_square_colour(TRAVELLER_COLUMN, floor * FLOOR_HEIGHT + 1, obj);
 	}
 }
 
+/**
+ * @brief Draws everything in one row of the playing field
+ * @arg y - row of the playing field
+ * @retval none
+*/
+void draw_row(uint16_t y) {
+	uint8_t row[WIDTH];
+	uint8_t fill = EMPTY_SQUARE;
+	if (y % FLOOR_HEIGHT == 0) {
+		fill = FLOOR;
+	}
+	for (uint8_t x = 0; x < WIDTH; x++) {
+		row[x] = fill;
+	}
+	if (y % FLOOR_HEIGHT == 1) {
+		uint8_t destination = controller_waiting_destination(y / FLOOR_HEIGHT);
+		if (destination != NO_FLOOR) {
+			row[TRAVELLER_COLUMN] = TRAVELLER_TO_0 + destination % 4;
+		}
+	}
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		uint16_t position = controller_car(c)->position;
+		if (y > position && y < position + FLOOR_HEIGHT) {
+			row[car_column[c]] = ELEVATOR;
+			row[car_column[c] + 1] = ELEVATOR;
+		}
+	}
+	for (uint8_t x = 0; x < WIDTH; x++) {
+		update_square_colour(x, y, row[x]);
+	}
+}
 
 /**
- * @brief Draws the elevator at the current_position
+ * @brief Scrolls the view of the building so that car 0 stays near the
+ * middle of the LED matrix. Only the rows that come into view are drawn -
+ * the rest are moved by shifting the display.
  * @arg none
  * @retval none
 */
-void draw_elevator(void) {
-	
-	// Store where it used to be with old_position
-	static uint8_t old_position; // static variables maintain their value, every time the function is called
-	
-	int8_t y = 0; // Height position to draw elevator (i.e. y axis)
-	
-	// Clear where the elevator was
-	if (old_position > current_position) { // Elevator going down - clear above
-		y = old_position + 3;
-		} else if (old_position < current_position) { // Elevator going up - clear below
-		y = old_position + 1;
+void follow_car(void) {
+	uint16_t position = controller_car(0)->position;
+	uint16_t target = 0;
+	if (position > (HEIGHT - FLOOR_HEIGHT) / 2) {
+		target = position - (HEIGHT - FLOOR_HEIGHT) / 2;
 	}
-	if (y % 4 != 0) { // Do not draw over the floor's LEDs
-		update_square_colour(1, y, EMPTY_SQUARE);
-		update_square_colour(2, y, EMPTY_SQUARE);
+	if (FIELD_HEIGHT <= HEIGHT) {
+		target = 0;
+	} else if (target > FIELD_HEIGHT - HEIGHT) {
+		target = FIELD_HEIGHT - HEIGHT;
 	}
-	old_position = current_position;
-	
-	// Draw a 2x3 block representing the elevator
-	for (uint8_t i = 1; i <= 3; i++) { // 3 is the height of the elevator sprite on the LED matrix
-		y = current_position + i; // Adds current floor position to i=1->3 to draw elevator as 3-high block
-		if (y % 4 != 0) { // Do not draw on the floor
-			update_square_colour(1, y, ELEVATOR);
-			update_square_colour(2, y, ELEVATOR); // Elevator is 2 LEDs wide so draw twice
-		}
+	while (display_view_bottom() < target) {
+		scroll_display_up();
+		draw_row(display_view_bottom() + HEIGHT - 1);
+	}
+	while (display_view_bottom() > target) {
+		scroll_display_down();
+		draw_row(display_view_bottom());
 	}
 }
 
 /**
- * @brief Reads btn values and serial input and adds a traveller as appropriate
+ * @brief Lowest floor whose floor line is on the LED matrix. The buttons
+ * and switches pick floors counting up from this one.
+ * @arg none
+ * @retval floor number
+*/
+uint8_t lowest_visible_floor(void) {
+	return (display_view_bottom() + FLOOR_HEIGHT - 1) / FLOOR_HEIGHT;
+}
+
+
+/**
+ * @brief Draws each elevator car at its current position
  * @arg none
  * @retval none
 */
-void handle_inputs(void) {
-	
-	
-	/* ******** START HERE ********
-	
-	 The following code handles moving the elevator using the buttons on the
-	 IO Board. Add code to handle BUTTON2_PUSHED and BUTTON3_PUSHED
-	 
-	 Here is how the following code works:
-	 1. Get btn presses (if any have occurred). Remember that this is
-		all handled in the buttons.c/h library.
-	 2. Use an if/else tree based on which of the buttons has been
-		pressed.
-	 3. Set the destination of the elevator to the FLOOR_X corresponding
-		with the particular button that was pressed.
+void draw_elevator(void) {
 	
-	*/
+	// Store where each car used to be with old_position
+	static uint16_t old_position[NUM_CARS]; // static variables maintain their value, every time the function is called
 	
-	// We need to check if any button has been pushed
-	uint8_t btn = button_pushed();
-	char serial_input = -1;
-	if (serial_input_available()) {
-		serial_input = fgetc(stdin);}
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		uint16_t current_position = controller_car(c)->position;
+		uint8_t x = car_column[c];
+		uint16_t y = 0; // Height position to draw elevator (i.e. y axis)
 		
-	if (traveller_present || (current_floor != destination)) {
-		return;
+		// Clear where the elevator was
+		if (old_position[c] > current_position) { // Elevator going down - clear above
+			y = old_position[c] + 3;
+			} else if (old_position[c] < current_position) { // Elevator going up - clear below
+			y = old_position[c] + 1;
+		}
+		if (y % 4 != 0) { // Do not draw over the floor's LEDs
+			update_square_colour(x, y, EMPTY_SQUARE);
+			update_square_colour(x + 1, y, EMPTY_SQUARE);
+		}
+		old_position[c] = current_position;
+		
+		// Draw a 2x3 block representing the elevator
+		for (uint8_t i = 1; i <= 3; i++) { // 3 is the height of the elevator sprite on the LED matrix
+			y = current_position + i; // Adds current floor position to i=1->3 to draw elevator as 3-high block
+			if (y % 4 != 0) { // Do not draw on the floor
+				update_square_colour(x, y, ELEVATOR);
+				update_square_colour(x + 1, y, ELEVATOR); // Elevator is 2 LEDs wide so draw twice
+			}
+		}
 	}
+}
+
+/**
+ * @brief Registers a hall call from a button or key, with the destination
+ * from switches S2 and S3. Both count up from the lowest floor on the LED
+ * matrix.
+ * @arg origin - floor the traveller is waiting at, counting from the
+ * lowest visible floor
+ * @arg time - when the button was pushed or the key typed
+ * @retval none
+*/
+void hall_call_from_inputs(uint8_t origin, uint32_t time) {
+	origin += lowest_visible_floor();
+	uint8_t dest = lowest_visible_floor() +
+			((input_switches() & SWITCH_DESTINATION_MASK) >> SWITCH_DESTINATION_SHIFT);
+	if (!controller_hall_call(origin, dest, time)) {
+		buzzer_play(tune_error);
+	}
+	moved = true;
+}
+
+// Cycles through the dispatch policies
+static void next_policy(void) {
+	controller_set_policy((controller_policy() + 1) % NUM_POLICIES);
+	moved = true;
+}
+
+/**
+ * @brief Acts on a single key typed on the serial terminal (outside a
+ * command line)
+ * @arg key - the character
+ * @arg time - when it was typed
+ * @retval none
+*/
+void handle_key(char key, uint32_t time) {
 	
+	// 'p' cycles through the dispatch policies
+	if (key == 'p' || key == 'P') {
+		next_policy();
+		return;
+	}
 	
-	uint8_t switch_bits = (PIND >> 5) & 0b11 ;
-	ElevatorFloor dest = UNDEF_FLOOR;
-	switch (switch_bits) {
-		case 0: dest = FLOOR_0; break;
-		case 1: dest = FLOOR_1; break;
-		case 2: dest = FLOOR_2; break;
-		case 3: dest = FLOOR_3; break;
+	// '+' and '-' change the brightness of the seven segment display
+	if (key == '+' || key == '-') {
+		uint8_t brightness = ssd_brightness();
+		if (key == '+') {
+			brightness = brightness <= 90 ? brightness + 10 : 100;
+		} else {
+			brightness = brightness >= 10 ? brightness - 10 : 0;
+		}
+		ssd_set_brightness(brightness);
+		return;
 	}
 	
-	if (btn == BUTTON0_PUSHED || serial_input == '0') {
-		if (dest == FLOOR_0) return;            
-		traveller_dest = dest;
-		traveller_floor = FLOOR_0;
-		traveller_present= true;
-		destination = FLOOR_0;      
-		draw_traveller();
-		beep(3000, 50);
-	}
-	else if (btn == BUTTON1_PUSHED || serial_input == '1') {
-		if (dest == FLOOR_1) return;
-		traveller_dest = dest;
-		traveller_floor = FLOOR_1;
-		traveller_present= true;
-		destination = FLOOR_1;
-		draw_traveller();
-		beep(3000, 50);
-	}
-	else if (btn == BUTTON2_PUSHED || serial_input == '2') {
-		if (dest == FLOOR_2) return;
-		traveller_dest = dest;
-		traveller_floor = FLOOR_2;
-		traveller_present = true;
-		destination = FLOOR_2;
-		draw_traveller();
-		beep(3000, 50);
-	}
-	else if (btn == BUTTON3_PUSHED || serial_input == '3') {
-		if (dest == FLOOR_3) return;
-		traveller_dest = dest;
-		traveller_floor = FLOOR_3;
-		traveller_present = true;
-		destination = FLOOR_3;
-		draw_traveller();
-		beep(3000, 50);
+	// A digit is a traveller waiting at that floor, like the buttons
+	if (key >= '0' && key <= '3') {
+		hall_call_from_inputs(key - '0', time);
+	}
+}
+
+/**
+ * @brief Acts on a button event (see buttons.h). A press is a traveller
+ * waiting at that floor, and holding the button adds another every
+ * BUTTON_REPEAT_MS from BUTTON_LONG_MS on, so several can be queued at
+ * once. Pressing it twice quickly cycles through the dispatch policies -
+ * as well as, not instead of, the traveller from the first press, which
+ * has been called by the time the second press makes it a double.
+ * @arg event - the button event
+ * @retval none
+*/
+void handle_button(const ButtonEvent* event) {
+	switch (event->type) {
+		case BUTTON_PRESS:
+		case BUTTON_LONG:
+		case BUTTON_REPEAT:
+			hall_call_from_inputs(event->button, event->time);
+			break;
+		case BUTTON_DOUBLE:
+			next_policy();
+			break;
+	}
+}
+
+/**
+ * @brief Acts on one input event - registers hall calls as appropriate and
+ * passes serial input to the command lines (see command.h). Calls are
+ * accepted at any time, including while the car is moving and while other
+ * travellers are waiting, and are made at the time of the event. All the
+ * input waiting on serial port 1 is read, so that command lines keep up
+ * with a test rig.
+ * @arg event - the input
+ * @retval none
+*/
+void handle_input(const InputEvent* event) {
+	switch (event->type) {
+		case INPUT_BUTTONS: {
+			ButtonEvent button;
+			while (button_event(&button)) {
+				handle_button(&button);
+			}
+			break;
+		}
+		case INPUT_KEY:
+			if (!command_input(COMMAND_TERMINAL, event->value)) {
+				handle_key(event->value, event->time);
+			}
+			break;
+		case INPUT_SWITCHES:
+			// The switches are read when they are needed (the speed
+			// switch at the next step)
+			break;
+		case INPUT_SERIAL1: {
+			// Serial port 1 only takes command lines
+			int16_t port1_input;
+			while ((port1_input = serial1_get_char()) >= 0) {
+				command_input(COMMAND_SERIAL1, port1_input);
+			}
+			break;
+		}
 	}
 }
 
 uint16_t get_speed(void) {
-	if (PIND & (1 << 4)) {
+	if (command_speed()) {
+		return command_speed();
+	}
+	if (input_switches() & SWITCH_SPEED) {
 		return 250;
-		} else {
+	} else {
 		return 100;
 	}
 }
\ No newline at end of file
@@ -2,95 +2,159 @@
  * buttons.c
  *
  * Author: Peter Sutton
+ * Modified by Lachlan Holliday
  */ 
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "buttons.h"
+#include "timer0.h"
 
 // Global variable to keep track of the last button state so that we 
-// can detect changes when an interrupt fires. The lower 4 bits (0 to 3)
-// will correspond to the last state of port B pins 0 to 3.
+// can detect changes when a new state is given. The lower 4 bits (0 to 3)
+// will correspond to the last (debounced) state of port B pins 0 to 3.
 static volatile uint8_t last_button_state;
 
-// Our button queue. button_queue[0] is always the head of the queue. If we
-// take something off the queue we just move everything else along. We don't
-// use a circular buffer since it is usually expected that the queue is very
-// short. In most uses it will never have more than 1 element at a time.
-// This button queue can be changed by the interrupt handler below so we should
-// turn off interrupts if we're changing the queue outside the handler.
-#define BUTTON_QUEUE_SIZE 4
-static volatile uint8_t button_queue[BUTTON_QUEUE_SIZE];
-static volatile int8_t queue_length;
-
-// Setup interrupt if any of pins B0 to B3 change. We do this
-// using a pin change interrupt. These pins correspond to pin
-// change interrupts PCINT8 to PCINT11 which are covered by
-// Pin change interrupt 1.
-void init_button_interrupts(void) {
-	// Enable the interrupt (see datasheet page 77)
-	PCICR |= (1<<PCIE1);
-	
-	// Make sure the interrupt flag is cleared (by writing a 
-	// 1 to it) (see datasheet page 78)
-	PCIFR |= (1<<PCIF1);
-	
-	// Choose which pins we're interested in by setting
-	// the relevant bits in the mask register (see datasheet page 78)
-	PCMSK1 |= (1<<PCINT8)|(1<<PCINT9)|(1<<PCINT10)|(1<<PCINT11);	
-	
-	// Empty the button push queue
-	queue_length = 0;
+// Our button event queue - a circular buffer indexed by free-running 8 bit
+// head and tail counts. Only buttons_update() (in an interrupt handler)
+// adds to it and only the main program takes from it, so neither needs to
+// turn off interrupts.
+#define QUEUE_MASK (BUTTON_QUEUE_SIZE - 1)
+static ButtonEvent button_queue[BUTTON_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+static volatile uint16_t events_dropped;
+
+// Gesture state of each button (only used by buttons_update()). A bit in
+// tapped is set when the button was released after a single short press,
+// so the next press can be a double; a bit in long_held once the button has
+// been held long enough to repeat.
+static uint32_t release_time[4];
+static uint32_t next_repeat[4];
+static uint8_t tapped;
+static uint8_t long_held;
+
+// Buttons that were held down at init_buttons(), ignored until released
+static uint8_t masked;
+
+// Called when an event is added to an empty queue, if set
+static ButtonHandler button_handler;
+
+void init_buttons(void) {
+	last_button_state = PINB & 0x0F;
+	masked = last_button_state;
+
+	// Empty the button event queue
+	queue_head = 0;
+	queue_tail = 0;
+	events_dropped = 0;
+	tapped = 0;
+	long_held = 0;
+	for(uint8_t pin=0; pin<=3; pin++) {
+		release_time[pin] = 0;
+		next_repeat[pin] = 0;
+	}
+	button_handler = 0;
+}
+
+void set_button_handler(ButtonHandler handler) {
+	button_handler = handler;
+}
+
+uint8_t button_event(ButtonEvent* event) {
+	uint8_t tail = queue_tail;
+	if(tail == queue_head) {
+		return 0;
+	}
+	*event = button_queue[tail & QUEUE_MASK];
+	queue_tail = tail + 1;
+	return 1;
 }
 
 int8_t button_pushed(void) {
-	int8_t return_value = NO_BUTTON_PUSHED;	// Assume no button pushed
-	if(queue_length > 0) {
-		// Remove the first element off the queue and move all the other
-		// entries closer to the front of the queue. We turn off interrupts (if on)
-		// before we make any changes to the queue. If interrupts were on
-		// we turn them back on when done.
-		return_value = button_queue[0];
-		
-		// Save whether interrupts were enabled and turn them off
-		int8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
-		cli();
-		
-		for(uint8_t i = 1; i < queue_length; i++) {
-			button_queue[i-1] = button_queue[i];
-		}
-		queue_length--;
-		
-		if(interrupts_were_enabled) {
-			// Turn them back on again
-			sei();
+	ButtonEvent event;
+	while(button_event(&event)) {
+		if(event.type == BUTTON_PRESS || event.type == BUTTON_DOUBLE) {
+			return event.button;
 		}
 	}
-	return return_value;
+	return NO_BUTTON_PUSHED;
 }
 
+void clear_button_events(void) {
+	queue_tail = queue_head;
+}
+
+uint16_t button_events_dropped(void) {
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint16_t count = events_dropped;
+	if(interrupts_were_enabled) {
+		sei();
+	}
+	return count;
+}
+
+// Add an event to the queue (if there is space)
+static void add_event(uint8_t button, uint8_t type, uint32_t time) {
+	uint8_t head = queue_head;
+	if((uint8_t)(head - queue_tail) >= BUTTON_QUEUE_SIZE) {
+		events_dropped++;
+		return;
+	}
+	ButtonEvent* event = &button_queue[head & QUEUE_MASK];
+	event->button = button;
+	event->type = type;
+	event->time = time;
+	queue_head = head + 1;
+	if(head == queue_tail && button_handler) {
+		button_handler();
+	}
+}
+
+// Called (from an interrupt handler) with the state of the buttons. We'll
+// compare this with the last state to see what has changed.
+void buttons_update(uint8_t button_state) {
+	uint8_t changed = button_state ^ last_button_state;
+	last_button_state = button_state;
+
+	// A button held since init_buttons() counts from its next press
+	masked &= button_state;
+	changed &= ~masked;
+	button_state &= ~masked;
+
+	// Nothing changed and nothing held (the usual case) - nothing to do
+	if(!changed && !button_state) {
+		return;
+	}
+	uint32_t now = get_current_time();
 
-// Interrupt handler for a change on buttons
-ISR(PCINT1_vect) {
-	// Get the current state of the buttons. We'll compare this with
-	// the last state to see what has changed.
-	uint8_t button_state = PINB & 0x0F;
-	
-	// Iterate over all the buttons and see which ones have changed.
-	// Any button pushes are added to the queue of button pushes (if
-	// there is space). We ignore button releases so we're just looking
-	// for a transition from 0 in the last_button_state bit to a 1 in the 
-	// button_state.
 	for(uint8_t pin=0; pin<=3; pin++) {
-		if(queue_length < BUTTON_QUEUE_SIZE && 
-				(button_state & (1<<pin)) && 
-				!(last_button_state & (1<<pin))) {
-			// Add the button push to the queue (and update the
-			// length of the queue
-			button_queue[queue_length++] = pin;
+		uint8_t bit = 1<<pin;
+		if(changed & bit) {
+			if(button_state & bit) {
+				// Pushed - a double if it closely follows a tap
+				uint8_t type = BUTTON_PRESS;
+				if((tapped & bit) && now - release_time[pin] <= BUTTON_DOUBLE_MS) {
+					type = BUTTON_DOUBLE;
+				}
+				add_event(pin, type, now);
+				next_repeat[pin] = now + BUTTON_LONG_MS;
+				// A double can't start another double
+				tapped = (tapped & ~bit) | (type == BUTTON_PRESS ? bit : 0);
+			} else {
+				add_event(pin, BUTTON_RELEASE, now);
+				release_time[pin] = now;
+				if(long_held & bit) {
+					tapped &= ~bit;
+				}
+				long_held &= ~bit;
+			}
+		} else if((button_state & bit) && (int32_t)(now - next_repeat[pin]) >= 0) {
+			// Held - the first time is a long press, then repeats
+			add_event(pin, (long_held & bit) ? BUTTON_REPEAT : BUTTON_LONG, now);
+			long_held |= bit;
+			next_repeat[pin] += BUTTON_REPEAT_MS;
 		}
 	}
-	
-	// Remember this button state
-	last_button_state = button_state;
 }
@@ -2,10 +2,23 @@
  * buttons.h
  *
  * Author: Peter Sutton
+ * Modified by Lachlan Holliday
  *
- * We assume four push buttons (B0 to B3) are connected to pins B0 to B3. We configure
- * pin change interrupts on these pins.
- */ 
+ * We assume four push buttons (B0 to B3) are connected to pins B0 to B3. Their
+ * state is debounced by inputs.c, which passes it to buttons_update() every
+ * timer tick.
+ *
+ * Each press and release is kept as a timestamped event, along with the
+ * gestures made from them:
+ *	- a press that comes within BUTTON_DOUBLE_MS of the release of a single
+ *	  short press of the same button is a BUTTON_DOUBLE rather than a
+ *	  BUTTON_PRESS. The first press has already given its BUTTON_PRESS by
+ *	  then - presses aren't held back to see whether a second follows - so
+ *	  a double is a BUTTON_PRESS and then a BUTTON_DOUBLE, and whatever
+ *	  the press does has been done once already.
+ *	- a button held for BUTTON_LONG_MS gives a BUTTON_LONG, then a
+ *	  BUTTON_REPEAT every BUTTON_REPEAT_MS until it is released.
+ */
 
 
 #ifndef BUTTONS_H_
@@ -19,20 +32,64 @@
 #define BUTTON2_PUSHED 2
 #define BUTTON3_PUSHED 3
 
-/* Set up pin change interrupts on pins B0 to B3.
+// Gesture timing (ms)
+#define BUTTON_DOUBLE_MS 300
+#define BUTTON_LONG_MS 600
+#define BUTTON_REPEAT_MS 250
+
+// Events kept before more are discarded (a power of 2)
+#define BUTTON_QUEUE_SIZE 16
+
+typedef enum {
+	BUTTON_PRESS,
+	BUTTON_DOUBLE,
+	BUTTON_RELEASE,
+	BUTTON_LONG,
+	BUTTON_REPEAT
+} ButtonEventType;
+
+typedef struct {
+	uint8_t button;		// 0 to 3
+	uint8_t type;		// ButtonEventType
+	uint32_t time;		// ms
+} ButtonEvent;
+
+/* Empty the queue of button events, taking the buttons held down now as
+ * already pushed (they give no events until released).
  * It is assumed that global interrupts are off when this function is called
  * and are enabled sometime after this function is called.
  */
-void init_button_interrupts(void);
+void init_buttons(void);
 
-/* Return the last button pushed (0 to 3) or -1 (NO_BUTTON_PUSHED) if 
- * there are no button pushes to return. (A small queue of button pushes
- * is kept. This function should be called frequently enough to
- * ensure the queue does not overflow. Excess button pushes are
- * discarded.)
+/* Give the (debounced) state of the buttons - bits 0 to 3 for B0 to B3, 1
+ * if the button is down. Called every timer tick from an interrupt handler.
  */
+void buttons_update(uint8_t button_state);
 
+/* Take the oldest button event off the queue. Returns 0 if there are none.
+ * (The queue should be read often enough that it does not overflow. Excess
+ * events are discarded - see button_events_dropped().)
+ */
+uint8_t button_event(ButtonEvent* event);
+
+/* Return the button of the next press (BUTTON_PRESS or BUTTON_DOUBLE) (0 to
+ * 3) or -1 (NO_BUTTON_PUSHED) if there are no button pushes to return.
+ * Other events before it are discarded.
+ */
 int8_t button_pushed(void);
 
+/* Throw away all the events waiting */
+void clear_button_events(void);
+
+/* Events discarded because the queue was full (wraps) */
+uint16_t button_events_dropped(void);
+
+/* Function called (from the interrupt handler) when an event is added to
+ * an empty queue, i.e. when there is something to read again after
+ * button_event() has returned 0.
+ */
+typedef void (*ButtonHandler)(void);
+void set_button_handler(ButtonHandler handler);
+
 
-#endif /* BUTTONS_H_ */
\ No newline at end of file
+#endif /* BUTTONS_H_ */
@@ -0,0 +1,159 @@
+/*
+ * buzzer.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Timer 2 runs in CTC mode with OC2A set to toggle on compare match, so
+ * the buzzer pin (D7) is driven entirely by hardware while a tone plays.
+ * Timer 1 runs in CTC mode with its clock divided by 1024 and OCR1A set
+ * to the length of the current tone. Its compare match interrupt loads the
+ * next entry of the sequence, or the next queued sequence when the current
+ * one is finished.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "buzzer.h"
+
+#define BUZZER_DDR DDRD
+#define BUZZER_PORT PORTD
+#define BUZZER_PIN PD7
+
+const Tone tune_chirp[] PROGMEM = {
+	TONE(3000, 50),
+	TONE_END
+};
+
+const Tone tune_arrival[] PROGMEM = {
+	TONE(660, 80),
+	REST(20),
+	TONE(500, 100),
+	TONE_END
+};
+
+const Tone tune_error[] PROGMEM = {
+	TONE(200, 60),
+	REST(40),
+	TONE(200, 60),
+	TONE_END
+};
+
+// Queue of sequences waiting to be played once the current one finishes.
+// current_tone points at the entry (in program memory) that is playing now,
+// or is 0 if the buzzer is idle.
+#define BUZZER_QUEUE_SIZE 4
+static const Tone* volatile sequence_queue[BUZZER_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_length;
+static const Tone* volatile current_tone;
+
+void init_buzzer(void) {
+	BUZZER_DDR |= (1<<BUZZER_PIN);
+	BUZZER_PORT &= ~(1<<BUZZER_PIN);
+
+	// Both timers are stopped until there is something to play
+	TCCR2A = 0;
+	TCCR2B = 0;
+	TCCR1A = 0;
+	TCCR1B = 0;
+	TIMSK1 |= (1<<OCIE1A);
+
+	queue_head = 0;
+	queue_length = 0;
+	current_tone = 0;
+}
+
+static void silence(void) {
+	// Disconnecting OC2A hands the pin back to PORTD, which holds it low
+	TCCR2A = 0;
+	TCCR2B = 0;
+	BUZZER_PORT &= ~(1<<BUZZER_PIN);
+}
+
+// Start playing the tone at current_tone. Returns 0 if it is the end
+// marker of its sequence. Must be called with interrupts disabled.
+static uint8_t load_tone(void) {
+	uint16_t duration = pgm_read_word(&current_tone->duration);
+	if(duration == 0) {
+		return 0;
+	}
+	uint8_t clock_select = pgm_read_byte(&current_tone->clock_select);
+	if(clock_select) {
+		TCCR2B = 0;
+		TCNT2 = 0;
+		OCR2A = pgm_read_byte(&current_tone->top);
+		TCCR2A = (1<<COM2A0)|(1<<WGM21);
+		TCCR2B = clock_select;
+	} else {
+		silence();
+	}
+
+	// Restart the duration timer
+	TCNT1 = 0;
+	OCR1A = duration - 1;
+	TIFR1 = (1<<OCF1A);
+	TCCR1B = (1<<WGM12)|(1<<CS12)|(1<<CS10);
+	return 1;
+}
+
+// Move on to the next tone that can be played, taking the next queued
+// sequence when the current one runs out. Must be called with interrupts
+// disabled.
+static void advance(void) {
+	while(!load_tone()) {
+		if(queue_length == 0) {
+			TCCR1B = 0;
+			silence();
+			current_tone = 0;
+			return;
+		}
+		current_tone = sequence_queue[queue_head];
+		queue_head = (queue_head + 1) % BUZZER_QUEUE_SIZE;
+		queue_length--;
+	}
+}
+
+uint8_t buzzer_play(const Tone* sequence) {
+	uint8_t accepted = 1;
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	if(current_tone == 0) {
+		current_tone = sequence;
+		advance();
+	} else if(queue_length < BUZZER_QUEUE_SIZE) {
+		sequence_queue[(queue_head + queue_length) % BUZZER_QUEUE_SIZE] = sequence;
+		queue_length++;
+	} else {
+		accepted = 0;
+	}
+	if(interrupts_were_enabled) {
+		sei();
+	}
+	return accepted;
+}
+
+void buzzer_stop(void) {
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	TCCR1B = 0;
+	silence();
+	current_tone = 0;
+	queue_length = 0;
+	if(interrupts_were_enabled) {
+		sei();
+	}
+}
+
+uint8_t buzzer_active(void) {
+	return current_tone != 0;
+}
+
+// The current tone has played for its full duration
+ISR(TIMER1_COMPA_vect) {
+	if(current_tone) {
+		current_tone++;
+		advance();
+	}
+}
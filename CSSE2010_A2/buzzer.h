@@ -0,0 +1,76 @@
+/*
+ * buzzer.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Interrupt driven buzzer on pin D7. The square wave is generated by
+ * Timer 2 toggling its OC2A output (pin D7) in hardware and the length
+ * of each tone is measured by Timer 1, whose compare match interrupt
+ * moves on to the next tone. Once a sequence is started no CPU time is
+ * used until a tone ends.
+ *
+ * Tone sequences are arrays of Tone stored in program memory and ended
+ * with TONE_END, e.g.
+ *	const Tone tune[] PROGMEM = { TONE(660, 80), REST(20), TONE(500, 100), TONE_END };
+ * All timer settings are worked out at compile time by the macros below.
+ */
+
+#ifndef BUZZER_H_
+#define BUZZER_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define BUZZER_CPU_HZ 8000000UL
+
+typedef struct {
+	uint8_t clock_select;	// Timer 2 clock select bits (0 for a rest)
+	uint8_t top;			// OCR2A value. Pin toggles on each compare match
+	uint16_t duration;		// Length of the tone in Timer 1 ticks (128us each)
+} Tone;
+
+// Does a tone of frequency f fit in Timer 2 with a clock divider of n?
+#define TONE_FITS(f, n) (BUZZER_CPU_HZ / (2UL * (n) * (f)) <= 256UL)
+
+// Smallest Timer 2 clock divider (and its clock select bits) for frequency f
+#define TONE_DIVIDER(f) (TONE_FITS(f, 1) ? 1UL : TONE_FITS(f, 8) ? 8UL : \
+		TONE_FITS(f, 32) ? 32UL : TONE_FITS(f, 64) ? 64UL : \
+		TONE_FITS(f, 128) ? 128UL : TONE_FITS(f, 256) ? 256UL : 1024UL)
+#define TONE_CLOCK_SELECT(f) (TONE_FITS(f, 1) ? 1 : TONE_FITS(f, 8) ? 2 : \
+		TONE_FITS(f, 32) ? 3 : TONE_FITS(f, 64) ? 4 : \
+		TONE_FITS(f, 128) ? 5 : TONE_FITS(f, 256) ? 6 : 7)
+
+// Milliseconds to Timer 1 ticks (clock divided by 1024)
+#define BUZZER_TICKS(ms) ((uint16_t)((ms) * (BUZZER_CPU_HZ / 1024UL) / 1000UL))
+
+// Sequence entries. freq is in Hz (15 to 65535), ms is 1 to 8000.
+#define TONE(freq, ms) { TONE_CLOCK_SELECT(freq), \
+		(uint8_t)(BUZZER_CPU_HZ / (2UL * TONE_DIVIDER(freq) * (freq)) - 1), \
+		BUZZER_TICKS(ms) }
+#define REST(ms) { 0, 0, BUZZER_TICKS(ms) }
+#define TONE_END { 0, 0, 0 }
+
+// Sequences used by the elevator emulator
+extern const Tone tune_chirp[] PROGMEM;		// hall call accepted
+extern const Tone tune_arrival[] PROGMEM;	// traveller picked up / dropped off
+extern const Tone tune_error[] PROGMEM;		// request rejected
+
+/* Set up Timer 1 and Timer 2 and make pin D7 an output. Should be called
+ * with interrupts disabled.
+ */
+void init_buzzer(void);
+
+/* Play the given sequence (which must be in program memory). If another
+ * sequence is playing the new one is queued behind it. Returns 1 if the
+ * sequence was started or queued, 0 if the queue was full and it was
+ * discarded. Never blocks.
+ */
+uint8_t buzzer_play(const Tone* sequence);
+
+/* Silence the buzzer and discard any queued sequences */
+void buzzer_stop(void);
+
+/* Returns non-zero while a sequence is playing */
+uint8_t buzzer_active(void);
+
+#endif /* BUZZER_H_ */
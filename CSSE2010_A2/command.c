@@ -0,0 +1,408 @@
+/*
+ * command.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "command.h"
+#include "controller.h"
+#include "ledmatrix.h"
+#include "scheduler.h"
+#include "serial1.h"
+#include "serialio.h"
+#include "spi.h"
+#include "stepmonitor.h"
+#include "telemetry.h"
+#include "terminalio.h"
+#include "timer0.h"
+
+#define MAX_SPEED 10000
+
+// Where the parser is in a line
+typedef enum {
+	LINE_NONE,		// not in a command line
+	LINE_START,		// after the ':', waiting for the command letter
+	LINE_ARGUMENTS,
+	LINE_DISCARD	// after an error, waiting for the end of the line
+} LineState;
+
+typedef enum {
+	ERROR_NONE,
+	ERROR_SYNTAX,
+	ERROR_RANGE,
+	ERROR_OVERRUN
+} CommandError;
+
+typedef struct {
+	uint8_t origin;
+	uint8_t destination;
+	uint32_t time;
+} PendingCall;
+
+// A command line being read from one of the ports
+typedef struct {
+	LineState state;
+	char command;
+	CommandError error;
+	uint16_t overruns;		// input overruns when the last character was read
+	uint8_t lost;			// characters were lost since the last line ended
+	// The item being parsed - up to three numbers, e.g. "2-0@5000"
+	uint32_t values[3];
+	uint8_t field;
+	uint8_t have_digits;
+	// Results of the line so far
+	uint16_t accepted;
+	uint16_t rejected;
+	uint32_t argument;
+	uint8_t num_arguments;
+} CommandLine;
+
+static uint8_t reply_x;
+static uint8_t reply_y;
+
+static CommandLine lines[COMMAND_NUM_PORTS];
+
+static PendingCall pending[COMMAND_MAX_PENDING];
+static uint8_t num_pending;
+// Future calls the controller turned down when they fell due
+static uint16_t late_rejected;
+static uint16_t speed;
+
+static void start_item(CommandLine* line) {
+	line->field = 0;
+	line->have_digits = 0;
+	line->values[0] = 0;
+}
+
+static uint16_t input_overruns(uint8_t port) {
+	return port == COMMAND_SERIAL1 ? serial1_input_overruns() :
+			serial_input_overruns();
+}
+
+void command_init(uint8_t x, uint8_t y) {
+	reply_x = x;
+	reply_y = y;
+	for(uint8_t port = 0; port < COMMAND_NUM_PORTS; port++) {
+		lines[port].state = LINE_NONE;
+		lines[port].overruns = input_overruns(port);
+		lines[port].lost = 0;
+	}
+	num_pending = 0;
+	late_rejected = 0;
+	speed = 0;
+}
+
+static void fail(CommandLine* line, CommandError reason) {
+	line->error = reason;
+	line->state = LINE_DISCARD;
+}
+
+// Make a call now, or remember it for later if its time hasn't come
+static void call(CommandLine* line, uint8_t origin, uint8_t destination,
+		uint32_t time) {
+	uint32_t now = get_current_time();
+	if((int32_t)(time - now) <= 0) {
+		if(controller_hall_call(origin, destination, now)) {
+			line->accepted++;
+		} else {
+			line->rejected++;
+		}
+	} else if(num_pending < COMMAND_MAX_PENDING && origin != destination &&
+			origin < NUM_FLOORS && destination < NUM_FLOORS) {
+		PendingCall* p = &pending[num_pending++];
+		p->origin = origin;
+		p->destination = destination;
+		p->time = time;
+		line->accepted++;
+	} else {
+		line->rejected++;
+	}
+}
+
+static void end_item(CommandLine* line) {
+	if(!line->have_digits) {
+		// Nothing at all is just extra separators, but "1-" isn't
+		if(line->field != 0) {
+			fail(line, ERROR_SYNTAX);
+		}
+		return;
+	}
+	if(line->command == 'C') {
+		if(line->field == 0) {
+			fail(line, ERROR_SYNTAX);
+			return;
+		}
+		if(line->values[0] > 255 || line->values[1] > 255) {
+			line->rejected++;
+		} else {
+			call(line, line->values[0], line->values[1],
+					line->field == 2 ? line->values[2] : get_current_time());
+		}
+	} else {
+		line->argument = line->values[0];
+		line->num_arguments++;
+	}
+	start_item(line);
+}
+
+// Carry out a command other than C, now that the whole line is here
+static void finish_line(CommandLine* line) {
+	uint8_t arguments_wanted = line->command == 'T' ||
+			line->command == 'J' || line->command == 'L' ? 0 : 1;
+	if(line->command == 'C' || line->error != ERROR_NONE) {
+		return;
+	}
+	// Q takes a task number or nothing
+	if(line->command == 'Q' && line->num_arguments == 0) {
+		arguments_wanted = 0;
+	}
+	if(line->num_arguments != arguments_wanted) {
+		line->error = ERROR_SYNTAX;
+		return;
+	}
+	uint32_t argument = line->argument;
+	switch(line->command) {
+		case 'M':
+			if(argument > 1) {
+				line->error = ERROR_RANGE;
+			} else {
+				telemetry_enable(argument);
+			}
+			break;
+		case 'Q':
+			if(argument >= scheduler_num_tasks()) {
+				line->error = ERROR_RANGE;
+			}
+			break;
+		case 'P':
+			if(argument >= NUM_POLICIES) {
+				line->error = ERROR_RANGE;
+			} else {
+				controller_set_policy(argument);
+			}
+			break;
+		case 'S':
+			if(argument > MAX_SPEED) {
+				line->error = ERROR_RANGE;
+			} else {
+				speed = argument;
+			}
+			break;
+	}
+}
+
+// Statistics asked for by Q: the loop's, or a task's
+static uint8_t print_stats(CommandLine* line, char* text, uint8_t size) {
+	if(line->num_arguments == 0) {
+		const LoopStats* loop = scheduler_loop_stats();
+		return snprintf_P(text, size, PSTR(" %u %lu"), loop->per_second,
+				(unsigned long)loop->max_period_us);
+	}
+	const TaskStats* stats = scheduler_task_stats(line->argument);
+	uint32_t runs = stats->runs;
+	uint8_t length = snprintf_P(text, size, PSTR(" %lu %lu %u %lu %u"),
+			(unsigned long)line->argument, (unsigned long)runs,
+			runs ? stats->min_us : 0,
+			runs ? (unsigned long)(stats->total_us / runs) : 0UL,
+			stats->max_us);
+	for(uint8_t i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS && length < size; i++) {
+		length += snprintf_P(text + length, size - length, PSTR(" %u"),
+				stats->histogram[i]);
+	}
+	return length < size ? length : size - 1;
+}
+
+// Step timing asked for by J
+static uint8_t print_steps(char* text, uint8_t size) {
+	const StepStats* stats = step_monitor_stats();
+	uint32_t intervals = stats->steps > 1 ? stats->steps - 1 : 1;
+	uint8_t length = snprintf_P(text, size, PSTR(" %lu %lu %lu %lu %lu"),
+			(unsigned long)stats->steps, (unsigned long)stats->misses,
+			(unsigned long)(stats->actual_us / intervals),
+			(unsigned long)(stats->intended_us / intervals),
+			(unsigned long)stats->max_lateness_us);
+	for(uint8_t i = 0; i < STEP_JITTER_BUCKETS && length < size; i++) {
+		length += snprintf_P(text + length, size - length, PSTR(" %u"),
+				stats->histogram[i]);
+	}
+	return length < size ? length : size - 1;
+}
+
+// LED matrix output and the SPI queue it goes through, asked for by L
+static uint8_t print_display(char* text, uint8_t size) {
+	uint8_t length = snprintf_P(text, size, PSTR(" %lu %ld %d %u %u"),
+			(unsigned long)ledmatrix_flush_bytes_sent(),
+			(long)ledmatrix_flush_bytes_saved(),
+			ledmatrix_last_frame_bytes_saved(), spi_queue_high_water(),
+			spi_queue_rejections());
+	return length < size ? length : size - 1;
+}
+
+// Replies on the port the line came from - on the terminal at the reply
+// position, and on port 1 as a plain line (or, while telemetry is on,
+// framed so the telemetry stream stays readable)
+static void reply(CommandLine* line, uint8_t port) {
+	char text[96];
+	uint8_t length = snprintf_P(text, sizeof(text),
+			line->error == ERROR_NONE ? PSTR("OK %c") : PSTR("ERR %c"),
+			line->command);
+	PGM_P reason = 0;
+	switch(line->error) {
+		case ERROR_SYNTAX:
+			reason = PSTR(" syntax");
+			break;
+		case ERROR_RANGE:
+			reason = PSTR(" range");
+			break;
+		case ERROR_OVERRUN:
+			reason = PSTR(" overrun");
+			break;
+		default:
+			break;
+	}
+	if(reason) {
+		strcpy_P(text + length, reason);
+		length += strlen(text + length);
+	}
+	if(line->command == 'C') {
+		length += snprintf_P(text + length, sizeof(text) - length,
+				PSTR(" %u %u"), line->accepted, line->rejected);
+	} else if(line->command == 'T' && line->error == ERROR_NONE) {
+		length += snprintf_P(text + length, sizeof(text) - length,
+				PSTR(" %lu %u %u"), (unsigned long)get_current_time(),
+				num_pending, late_rejected);
+	} else if(line->command == 'Q' && line->error == ERROR_NONE) {
+		length += print_stats(line, text + length, sizeof(text) - length - 1);
+	} else if(line->command == 'J' && line->error == ERROR_NONE) {
+		length += print_steps(text + length, sizeof(text) - length - 1);
+	} else if(line->command == 'L' && line->error == ERROR_NONE) {
+		length += print_display(text + length, sizeof(text) - length - 1);
+	}
+
+	if(port == COMMAND_SERIAL1) {
+		text[length++] = '\n';
+		if(telemetry_enabled()) {
+			telemetry_reply(text, length);
+			return;
+		}
+		uint8_t policy = serial1_set_output_policy(SERIAL_BLOCK);
+		serial1_write(text, length);
+		serial1_set_output_policy(policy);
+		return;
+	}
+	move_terminal_cursor(reply_x, reply_y);
+	printf("%s", text);
+	clear_to_end_of_line();
+	putchar('\n');
+}
+
+uint8_t command_input(uint8_t port, char c) {
+	CommandLine* line = &lines[port];
+
+	// A character lost because the input buffer was full came after the
+	// last one read (everything before it was already in the buffer), so
+	// only this character and the rest of the line can be affected. Calls
+	// already made from the line are good; the line (or the next to start)
+	// goes no further.
+	uint16_t overruns = input_overruns(port);
+	if(overruns != line->overruns) {
+		line->overruns = overruns;
+		line->lost = 1;
+	}
+	if(line->lost && line->state != LINE_NONE) {
+		fail(line, ERROR_OVERRUN);
+	}
+
+	switch(line->state) {
+		case LINE_NONE:
+			if(c != ':') {
+				return 0;
+			}
+			line->state = LINE_START;
+			line->command = '?';
+			line->error = ERROR_NONE;
+			if(line->lost) {
+				fail(line, ERROR_OVERRUN);
+			}
+			line->accepted = 0;
+			line->rejected = 0;
+			line->num_arguments = 0;
+			start_item(line);
+			return 1;
+		case LINE_START:
+			if(c >= 'a' && c <= 'z') {
+				c -= 'a' - 'A';
+			}
+			if(c == 'C' || c == 'J' || c == 'L' || c == 'M' || c == 'P' ||
+					c == 'Q' || c == 'S' || c == 'T') {
+				line->command = c;
+				line->state = LINE_ARGUMENTS;
+				return 1;
+			}
+			fail(line, ERROR_SYNTAX);
+			break;
+		case LINE_ARGUMENTS: {
+			uint32_t* value = &line->values[line->field];
+			if(c >= '0' && c <= '9') {
+				// Numbers bigger than 32 bits are an error
+				if(*value > (UINT32_MAX - 9) / 10) {
+					fail(line, ERROR_RANGE);
+				} else {
+					*value = *value * 10 + c - '0';
+					line->have_digits = 1;
+				}
+			} else if(line->command == 'C' && line->have_digits &&
+					((c == '-' && line->field == 0) ||
+					(c == '@' && line->field == 1))) {
+				line->values[++line->field] = 0;
+				line->have_digits = 0;
+			} else if(c == ' ' || c == ',' || c == '\n') {
+				end_item(line);
+			} else {
+				fail(line, ERROR_SYNTAX);
+			}
+			break;
+		}
+		case LINE_DISCARD:
+			break;
+	}
+	if(c == '\n') {
+		finish_line(line);
+		reply(line, port);
+		line->state = LINE_NONE;
+		line->lost = 0;
+	}
+	return 1;
+}
+
+uint8_t command_poll(uint32_t now) {
+	uint8_t made = 0;
+	uint8_t i = 0;
+	while(i < num_pending) {
+		if((int32_t)(now - pending[i].time) < 0) {
+			i++;
+			continue;
+		}
+		if(controller_hall_call(pending[i].origin, pending[i].destination,
+				now)) {
+			made++;
+		} else {
+			late_rejected++;
+		}
+		// Keep the rest in the order they were given
+		num_pending--;
+		for(uint8_t j = i; j < num_pending; j++) {
+			pending[j] = pending[j + 1];
+		}
+	}
+	return made;
+}
+
+uint16_t command_speed(void) {
+	return speed;
+}
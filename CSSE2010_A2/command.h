@@ -0,0 +1,88 @@
+/*
+ * command.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Line based command protocol on the serial port, so that a test rig can
+ * drive the emulator. A command line starts with ':' and a command letter
+ * and ends with a carriage return or linefeed. Anything outside a command
+ * line is left for the single key controls. Lines are parsed as the
+ * characters arrive, so a batch of calls can be any length. Commands can
+ * come from the terminal or from serial port 1 (each has its own line),
+ * and are answered on the port they came from.
+ *
+ *	:C o-d o-d@t ...	hall calls from floor o to floor d, separated by
+ *						spaces or commas. With @t the call is made at time
+ *						t (ms, see :T) instead of straight away.
+ *	:J					timing of the car steps (see stepmonitor.h)
+ *	:L					LED matrix output (see ledmatrix.h and spi.h)
+ *	:M n				binary telemetry on (1) or off (0) - see telemetry.h
+ *	:P n				dispatch policy n (0 LOOK, 1 SCAN, 2 nearest)
+ *	:Q					main loop statistics (see scheduler.h)
+ *	:Q n				CPU time used by scheduler task n
+ *	:S n				step the cars every n ms (1 to 10000), or 0 to go
+ *						back to the speed switch
+ *	:T					current time (ms)
+ *
+ * Each line is answered with one line, "OK" or "ERR" followed by the
+ * command letter and:
+ *	C	calls accepted and calls rejected (invalid floors, or the call
+ *		register or the list of future calls full). A future call is
+ *		accepted when it is added to the list; see T for what happens
+ *		when it falls due.
+ *	J	steps, steps that started late enough to miss their deadline,
+ *		the average time between steps and the average period they were
+ *		meant to take (us), the latest a step started (us) and the
+ *		histogram of how late they started (STEP_JITTER_BUCKETS counts -
+ *		under 64us, under 128us, ... and 4ms or more)
+ *	L	bytes ledmatrix_flush() has queued for the matrix, the bytes that
+ *		saved compared with sending each changed pixel on its own, the
+ *		bytes saved in the last whole frame, the most bytes that have
+ *		waited in the SPI queue at once, and the times bytes were turned
+ *		away from the SPI queue for lack of room
+ *	Q	for the loop, its iterations per second and longest busy period
+ *		(us); for task n, n, its runs, its shortest, average and longest
+ *		run (us) and its histogram of run times (SCHEDULER_HISTOGRAM_BUCKETS
+ *		counts - runs under 128us, under 256us, ... and 8ms or more)
+ *	T	the time, the future calls still waiting and the future calls
+ *		rejected when they fell due (the call register was full then)
+ * An error also gives the reason ("syntax", "range" or "overrun") before
+ * these. If characters were lost because the serial input buffer
+ * overflowed, the line they were lost from (or the next line, if they were
+ * lost between lines) stops there and is answered with "ERR C overrun" and
+ * the calls made before the loss.
+ */
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdint.h>
+
+// Calls with a time in the future that can be waiting at once
+#define COMMAND_MAX_PENDING 16
+
+// Ports commands come from
+#define COMMAND_TERMINAL 0	// serial port 0 (serialio.h)
+#define COMMAND_SERIAL1 1	// serial port 1 (serial1.h)
+#define COMMAND_NUM_PORTS 2
+
+/* Start with no command lines and no future calls. Replies on the
+ * terminal are written at column x, row y.
+ */
+void command_init(uint8_t x, uint8_t y);
+
+/* Give the parser the next character from a port (COMMAND_TERMINAL or
+ * COMMAND_SERIAL1). Returns 1 if it was part of a command line, or 0 if it
+ * should be treated as a key.
+ */
+uint8_t command_input(uint8_t port, char c);
+
+/* Make any future calls that are now due. Returns the number the
+ * controller accepted (the rest are counted, see T above).
+ */
+uint8_t command_poll(uint32_t now);
+
+/* Step period set by :S, or 0 if the speed switch should be used */
+uint16_t command_speed(void);
+
+#endif /* COMMAND_H_ */
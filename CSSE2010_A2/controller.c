@@ -0,0 +1,387 @@
+/*
+ * controller.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * A car only changes direction when it is level with a floor. Each step
+ * every car picks its direction (if level with a floor), moves one row, and
+ * if it is then level with a floor lets riders for that floor out and the
+ * travellers waiting there for it in. Travellers only get in if they want
+ * to go the way the car is about to go, except under POLICY_NEAREST where
+ * everyone gets in.
+ */
+
+#include <stdint.h>
+
+#include "controller.h"
+
+#define TOP_POSITION ((NUM_FLOORS - 1) * FLOOR_HEIGHT)
+
+static Car cars[NUM_CARS];
+
+// Travellers waiting to be picked up, oldest first
+static Traveller waiting[MAX_WAITING];
+static uint8_t num_waiting;
+
+static DispatchPolicy policy = POLICY_LOOK;
+static ControllerStats stats;
+static ControllerEventHandler event_handler;
+
+void controller_init(uint32_t now) {
+	for(uint8_t c = 0; c < NUM_CARS; c++) {
+		Car* car = &cars[c];
+		car->position = 0;
+		car->floor = 0;
+		car->direction = DIRECTION_NONE;
+		car->last_move = DIRECTION_NONE;
+		car->num_riders = 0;
+		car->floors_with_traveller = 0;
+		car->floors_without_traveller = 0;
+		car->journeys = 0;
+		car->total_wait = 0;
+	}
+	num_waiting = 0;
+
+	stats.calls = 0;
+	stats.rejected_calls = 0;
+	stats.journeys = 0;
+	stats.total_wait = 0;
+	stats.total_journey = 0;
+	stats.max_wait = 0;
+	stats.start_time = now;
+}
+
+void controller_set_event_handler(ControllerEventHandler handler) {
+	event_handler = handler;
+}
+
+void controller_set_policy(DispatchPolicy new_policy) {
+	if(new_policy < NUM_POLICIES) {
+		policy = new_policy;
+	}
+}
+
+DispatchPolicy controller_policy(void) {
+	return policy;
+}
+
+static void report(ControllerEventType type, uint8_t car, uint8_t floor,
+		const Traveller* traveller, uint32_t now) {
+	if(event_handler) {
+		ControllerEvent event = { type, car, floor, traveller, now };
+		event_handler(&event);
+	}
+}
+
+static int8_t direction_between(uint16_t from, uint16_t to) {
+	if(to > from) {
+		return DIRECTION_UP;
+	} else if(to < from) {
+		return DIRECTION_DOWN;
+	}
+	return DIRECTION_NONE;
+}
+
+static uint16_t distance_between(uint16_t from, uint16_t to) {
+	return to > from ? to - from : from - to;
+}
+
+// Position of the i'th stop car c has to make - the destinations of its
+// riders followed by the floors where travellers given to it are waiting
+// (unless it is full). Returns 0 once i is past the last stop.
+static uint8_t stop_position(uint8_t c, uint8_t i, uint16_t* position) {
+	Car* car = &cars[c];
+	if(i < car->num_riders) {
+		*position = car->riders[i].destination * FLOOR_HEIGHT;
+		return 1;
+	}
+	if(car->num_riders >= CAR_CAPACITY) {
+		return 0;
+	}
+	for(uint8_t j = 0; j < num_waiting; j++) {
+		if(waiting[j].car == c && i-- == car->num_riders) {
+			*position = waiting[j].origin * FLOOR_HEIGHT;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Direction car c should head in from its current floor. Stops at the
+// current floor are left out - they are dealt with when travellers get in.
+static int8_t choose_direction(uint8_t c) {
+	Car* car = &cars[c];
+	uint8_t work_above = 0;
+	uint8_t work_below = 0;
+	uint16_t nearest_distance = 0xFFFF;
+	int8_t nearest_direction = DIRECTION_NONE;
+	uint16_t position;
+
+	for(uint8_t i = 0; stop_position(c, i, &position); i++) {
+		int8_t direction = direction_between(car->position, position);
+		if(direction == DIRECTION_UP) {
+			work_above = 1;
+		} else if(direction == DIRECTION_DOWN) {
+			work_below = 1;
+		} else {
+			continue;
+		}
+		uint16_t distance = distance_between(car->position, position);
+		if(distance < nearest_distance ||
+				(distance == nearest_distance && direction == car->direction)) {
+			nearest_distance = distance;
+			nearest_direction = direction;
+		}
+	}
+
+	switch(policy) {
+		case POLICY_SCAN:
+			// Carry on to the end of the shaft while there is any work
+			if(!work_above && !work_below) {
+				return DIRECTION_NONE;
+			}
+			if(car->direction == DIRECTION_UP && car->position < TOP_POSITION) {
+				return DIRECTION_UP;
+			}
+			if(car->direction == DIRECTION_DOWN && car->position > 0) {
+				return DIRECTION_DOWN;
+			}
+			if(car->position == 0) {
+				return DIRECTION_UP;
+			}
+			if(car->position == TOP_POSITION) {
+				return DIRECTION_DOWN;
+			}
+			return work_above ? DIRECTION_UP : DIRECTION_DOWN;
+		case POLICY_NEAREST:
+			return nearest_direction;
+		default:
+			// LOOK - carry on while there is work ahead
+			if(car->direction == DIRECTION_UP && work_above) {
+				return DIRECTION_UP;
+			}
+			if(car->direction == DIRECTION_DOWN && work_below) {
+				return DIRECTION_DOWN;
+			}
+			if(work_above) {
+				return DIRECTION_UP;
+			}
+			if(work_below) {
+				return DIRECTION_DOWN;
+			}
+			return DIRECTION_NONE;
+	}
+}
+
+// Estimated number of rows car c has to travel before it can pick up a
+// traveller at origin going in direction call_direction. The car is taken
+// to carry on its current sweep as far as its furthest stop (or the end of
+// the shaft under SCAN), turn, and if need be turn once more.
+static uint16_t estimate_arrival(uint8_t c, uint8_t origin,
+		int8_t call_direction) {
+	Car* car = &cars[c];
+	uint16_t from = car->position;
+	uint16_t to = origin * FLOOR_HEIGHT;
+	if(car->direction == DIRECTION_NONE || policy == POLICY_NEAREST) {
+		return distance_between(from, to);
+	}
+
+	// Furthest the car goes in each direction before it turns round
+	uint16_t high = from;
+	uint16_t low = from;
+	if(policy == POLICY_SCAN) {
+		high = TOP_POSITION;
+		low = 0;
+	} else {
+		uint16_t position;
+		for(uint8_t i = 0; stop_position(c, i, &position); i++) {
+			if(position > high) {
+				high = position;
+			}
+			if(position < low) {
+				low = position;
+			}
+		}
+	}
+
+	if(car->direction == DIRECTION_UP) {
+		if(call_direction == DIRECTION_UP && to >= from) {
+			return to - from;
+		}
+		if(to > high) {
+			high = to;
+		}
+		if(call_direction == DIRECTION_DOWN) {
+			return (high - from) + (high - to);
+		}
+		if(to < low) {
+			low = to;
+		}
+		return (high - from) + (high - low) + (to - low);
+	} else {
+		if(call_direction == DIRECTION_DOWN && to <= from) {
+			return from - to;
+		}
+		if(to < low) {
+			low = to;
+		}
+		if(call_direction == DIRECTION_UP) {
+			return (from - low) + (to - low);
+		}
+		if(to > high) {
+			high = to;
+		}
+		return (from - low) + (high - low) + (high - to);
+	}
+}
+
+uint8_t controller_hall_call(uint8_t origin, uint8_t destination, uint32_t now) {
+	if(origin >= NUM_FLOORS || destination >= NUM_FLOORS ||
+			origin == destination || num_waiting >= MAX_WAITING) {
+		stats.rejected_calls++;
+		return 0;
+	}
+
+	// Give the call to the car that should get there first. Ties go to the
+	// car with the fewest travellers already to look after.
+	int8_t call_direction = direction_between(origin, destination);
+	uint8_t best_car = 0;
+	uint16_t best_eta = 0xFFFF;
+	uint8_t best_load = 0xFF;
+	for(uint8_t c = 0; c < NUM_CARS; c++) {
+		uint16_t eta = estimate_arrival(c, origin, call_direction);
+		uint8_t load = cars[c].num_riders;
+		for(uint8_t i = 0; i < num_waiting; i++) {
+			if(waiting[i].car == c) {
+				load++;
+			}
+		}
+		if(eta < best_eta || (eta == best_eta && load < best_load)) {
+			best_car = c;
+			best_eta = eta;
+			best_load = load;
+		}
+	}
+
+	Traveller* traveller = &waiting[num_waiting++];
+	traveller->origin = origin;
+	traveller->destination = destination;
+	traveller->car = best_car;
+	traveller->call_time = now;
+	traveller->pickup_time = 0;
+	stats.calls++;
+	report(EVENT_HALL_CALL, best_car, origin, traveller, now);
+	return 1;
+}
+
+// Let riders of car c out and the travellers waiting for it in at the
+// given floor
+static void service_floor(uint8_t c, uint8_t floor, uint32_t now) {
+	Car* car = &cars[c];
+	for(uint8_t i = 0; i < car->num_riders; ) {
+		Traveller* rider = &car->riders[i];
+		if(rider->destination != floor) {
+			i++;
+			continue;
+		}
+		uint32_t journey = now - rider->call_time;
+		stats.journeys++;
+		stats.total_journey += journey;
+		car->journeys++;
+		report(EVENT_DROPOFF, c, floor, rider, now);
+		// Replace with the last rider
+		*rider = car->riders[--car->num_riders];
+	}
+
+	// Work out which way the car goes next. If it is empty, or has nowhere
+	// else to be, it goes the way the longest waiting traveller here wants
+	// to go. An empty car heading off to another call would otherwise
+	// leave them behind, and with calls on neighbouring floors wanting to
+	// go towards each other it can go back and forth between them several
+	// times before picking anyone up.
+	int8_t direction = car->num_riders ? choose_direction(c) : DIRECTION_NONE;
+	for(uint8_t i = 0; i < num_waiting && direction == DIRECTION_NONE; i++) {
+		if(waiting[i].car == c && waiting[i].origin == floor) {
+			direction = direction_between(floor, waiting[i].destination);
+		}
+	}
+
+	for(uint8_t i = 0; i < num_waiting; ) {
+		Traveller* traveller = &waiting[i];
+		if(traveller->car != c || traveller->origin != floor ||
+				car->num_riders >= CAR_CAPACITY ||
+				(policy != POLICY_NEAREST && direction !=
+				direction_between(floor, traveller->destination))) {
+			i++;
+			continue;
+		}
+		traveller->pickup_time = now;
+		uint32_t wait = now - traveller->call_time;
+		stats.total_wait += wait;
+		if(wait > stats.max_wait) {
+			stats.max_wait = wait;
+		}
+		car->total_wait += wait;
+		Traveller* rider = &car->riders[car->num_riders++];
+		*rider = *traveller;
+		// Remove from the waiting list, keeping the rest in order. This
+		// comes before the event so that the handler sees the floor
+		// without them (e.g. to stop drawing them waiting there).
+		num_waiting--;
+		for(uint8_t j = i; j < num_waiting; j++) {
+			waiting[j] = waiting[j+1];
+		}
+		report(EVENT_PICKUP, c, floor, rider, now);
+	}
+
+	car->direction = choose_direction(c);
+}
+
+void controller_step(uint32_t now) {
+	for(uint8_t c = 0; c < NUM_CARS; c++) {
+		Car* car = &cars[c];
+		if(car->position % FLOOR_HEIGHT == 0) {
+			car->direction = choose_direction(c);
+		}
+
+		car->last_move = car->direction;
+		if(car->direction != DIRECTION_NONE) {
+			car->position += car->direction;
+			report(EVENT_CAR_STEP, c, car->floor, 0, now);
+			if(car->position % FLOOR_HEIGHT == 0) {
+				car->floor = car->position / FLOOR_HEIGHT;
+				if(car->num_riders) {
+					car->floors_with_traveller++;
+				} else {
+					car->floors_without_traveller++;
+				}
+				report(EVENT_ARRIVAL, c, car->floor, 0, now);
+			}
+		}
+
+		if(car->position % FLOOR_HEIGHT == 0) {
+			service_floor(c, car->floor, now);
+		}
+	}
+}
+
+const Car* controller_car(uint8_t car) {
+	return &cars[car];
+}
+
+const ControllerStats* controller_stats(void) {
+	return &stats;
+}
+
+uint8_t controller_num_waiting(void) {
+	return num_waiting;
+}
+
+uint8_t controller_waiting_destination(uint8_t floor) {
+	for(uint8_t i = 0; i < num_waiting; i++) {
+		if(waiting[i].origin == floor) {
+			return waiting[i].destination;
+		}
+	}
+	return NO_FLOOR;
+}
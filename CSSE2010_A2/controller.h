@@ -0,0 +1,132 @@
+/*
+ * controller.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Elevator control logic. Keeps the register of hall calls (travellers
+ * waiting at a floor to go to another floor), the state of each car and the
+ * travellers riding in it, and decides where the cars go next using one of
+ * several dispatch policies. Each hall call is given to the car estimated
+ * to reach it first. Nothing in here touches the hardware - the main
+ * program calls controller_step() every time the cars should move one row
+ * and reacts to the events it reports.
+ */
+
+#ifndef CONTROLLER_H_
+#define CONTROLLER_H_
+
+#include <stdint.h>
+
+// Rows of the LED matrix per floor, and number of floors (up to 64)
+#define FLOOR_HEIGHT 4
+#ifndef NUM_FLOORS
+#define NUM_FLOORS 4
+#endif
+#if NUM_FLOORS < 2 || NUM_FLOORS > 64
+#error "NUM_FLOORS must be between 2 and 64"
+#endif
+#define NO_FLOOR 0xFF
+
+// Number of cars in the group (1 to 3 fit on the LED matrix)
+#ifndef NUM_CARS
+#define NUM_CARS 2
+#endif
+
+// Limits on the number of travellers waiting for a car and riding in one
+#define MAX_WAITING 16
+#define CAR_CAPACITY 8
+
+#define DIRECTION_DOWN (-1)
+#define DIRECTION_NONE 0
+#define DIRECTION_UP 1
+
+typedef enum {
+	POLICY_LOOK,	// Sweep while there are calls ahead, then reverse
+	POLICY_SCAN,	// Sweep to the end of the shaft before reversing
+	POLICY_NEAREST,	// Always head for the closest call or destination
+	NUM_POLICIES
+} DispatchPolicy;
+
+typedef struct {
+	uint8_t origin;
+	uint8_t destination;
+	uint8_t car;			// car the call was given to
+	uint32_t call_time;		// when the hall call was made (ms)
+	uint32_t pickup_time;	// when the traveller got into the car (ms)
+} Traveller;
+
+typedef struct {
+	uint16_t position;		// rows above the ground floor
+	uint8_t floor;			// last floor the car was level with
+	int8_t direction;		// direction of the current sweep
+	int8_t last_move;		// direction moved in the last step (0 if none)
+	uint8_t num_riders;
+	Traveller riders[CAR_CAPACITY];
+	uint32_t floors_with_traveller;
+	uint32_t floors_without_traveller;
+	uint32_t journeys;		// travellers delivered by this car
+	uint32_t total_wait;	// sum of their call to pickup times (ms)
+} Car;
+
+typedef struct {
+	uint32_t calls;				// hall calls accepted
+	uint32_t rejected_calls;	// hall calls refused
+	uint32_t journeys;			// travellers delivered
+	uint32_t total_wait;		// sum of call to pickup times (ms)
+	uint32_t total_journey;		// sum of call to drop off times (ms)
+	uint32_t max_wait;
+	uint32_t start_time;
+} ControllerStats;
+
+typedef enum {
+	EVENT_HALL_CALL,	// a call was accepted
+	EVENT_CAR_STEP,		// the car moved one row
+	EVENT_ARRIVAL,		// the car became level with a floor
+	EVENT_PICKUP,		// a traveller got in (and is no longer waiting)
+	EVENT_DROPOFF		// a traveller got out
+} ControllerEventType;
+
+typedef struct {
+	ControllerEventType type;
+	uint8_t car;				// car the event concerns (for calls, the car given the call)
+	uint8_t floor;				// floor of the event (or car floor for steps)
+	const Traveller* traveller;	// for calls, pickups and drop offs
+	uint32_t time;
+} ControllerEvent;
+
+typedef void (*ControllerEventHandler)(const ControllerEvent* event);
+
+/* Reset the cars to the ground floor, empty the call register and clear the
+ * statistics. now is the current time in milliseconds.
+ */
+void controller_init(uint32_t now);
+
+/* Function to call for each event as it happens (may be 0) */
+void controller_set_event_handler(ControllerEventHandler handler);
+
+void controller_set_policy(DispatchPolicy policy);
+DispatchPolicy controller_policy(void);
+
+/* Register a traveller waiting at floor origin to go to floor destination
+ * and give the call to the car with the earliest estimated arrival.
+ * Returns 1 if the call was accepted, 0 if it was invalid (same floor or
+ * no such floor) or the call register is full.
+ */
+uint8_t controller_hall_call(uint8_t origin, uint8_t destination, uint32_t now);
+
+/* Move each car one row towards its next stop (if it has one) and let
+ * travellers on and off if it is level with a floor.
+ */
+void controller_step(uint32_t now);
+
+/* State of car number car (0 to NUM_CARS-1) and the group statistics */
+const Car* controller_car(uint8_t car);
+const ControllerStats* controller_stats(void);
+
+/* Number of travellers waiting, and the destination of the traveller who
+ * has been waiting longest at the given floor (NO_FLOOR if nobody is).
+ */
+uint8_t controller_num_waiting(void);
+uint8_t controller_waiting_destination(uint8_t floor);
+
+#endif /* CONTROLLER_H_ */
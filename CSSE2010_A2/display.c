@@ -32,9 +32,34 @@ static const uint16_t elevator_display[MATRIX_NUM_COLUMNS] = {
 	(1<<7)|(1<<6)|(1<<5)|(1<<4)|(1<<3)|(1<<2)|(1<<1)|(1<<0) | (0<<8)
 	};
 
+// lowest row of the playing field shown on the display
+static uint16_t view_bottom;
+
 void initialise_display(void) {
 	// clear the LED matrix
 	ledmatrix_clear();
+	view_bottom = 0;
+}
+
+uint16_t display_view_bottom(void) {
+	return view_bottom;
+}
+
+/*
+ * Rows of the playing field run along the LED matrix columns (see
+ * update_square_colour), so moving the view up one row moves the image
+ * one column to the right, and the new top row comes in at column 0.
+ */
+void scroll_display_up(void) {
+	ledmatrix_shift_display_right();
+	view_bottom++;
+}
+
+void scroll_display_down(void) {
+	if (view_bottom > 0) {
+		ledmatrix_shift_display_left();
+		view_bottom--;
+	}
 }
 
 void start_display(void) {
@@ -91,13 +116,14 @@ void start_display_animation(uint8_t frame) {
  * This function treats x and y coordinates in some unintuitive ways.
   * You are not expected to follow all the logic of this.
  */
-void update_square_colour(uint8_t x, uint8_t y, uint8_t object) {
+void update_square_colour(uint8_t x, uint16_t y, uint8_t object) {
 	
-	// first check that this is a square within the game field
-	// if outside the game field, don't update anything
-	if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) {
+	// first check that this is a square within the part of the game
+	// field on display - if not, don't update anything
+	if (x >= WIDTH || y < view_bottom || y - view_bottom >= HEIGHT) {
 		return;
 	}
+	y -= view_bottom;
 	
 	// determine which colour corresponds to this object
 	PixelColour colour;
@@ -125,5 +151,9 @@ void update_square_colour(uint8_t x, uint8_t y, uint8_t object) {
 	 * controller treats the matrix vertically. We also want x
 	 * to be interpreted as from bottom to top, not top to bottom.
 	 */
-	ledmatrix_update_pixel(15 - y, x, colour); 
+	/* The change is only recorded here. It reaches the LED matrix the next
+	 * time ledmatrix_flush() is called, and not at all if the square
+	 * already has this colour.
+	 */
+	ledmatrix_set_pixel(15 - y, x, colour);
 }
\ No newline at end of file
@@ -7,9 +7,11 @@
 #ifndef DISPLAY_H_
 #define DISPLAY_H_
 
+#include <stdint.h>
 #include "pixel_colour.h"
 
-// display dimensions, these match the size of the playing field
+// display dimensions - the playing field is WIDTH squares wide and
+// can be taller than HEIGHT, in which case the display shows part of it
 #define WIDTH  8
 #define HEIGHT 16
 
@@ -57,11 +59,25 @@ void start_display(void);
 void start_display_animation(uint8_t frame);
 
 /*
- * updates the colour at square (x, y) to be the colour
+ * lowest row of the playing field on display
+ */
+uint16_t display_view_bottom(void);
+
+/*
+ * move the view of the playing field up or down one row by shifting the
+ * LED matrix. The row that comes into view is blank and has to be drawn
+ * by the caller.
+ */
+void scroll_display_up(void);
+void scroll_display_down(void);
+
+/*
+ * updates the colour at square (x, y) of the playing field to be the colour
  * of the object 'object'
  * 'object' is expected to be EMPTY_SQUARE, PLAYER, FACING, 
  * BREAKABLE, UNBREAKABLE, DIAMOND or UNDISCOVERED
+ * The LED matrix is updated by the next ledmatrix_flush()
  */
-void update_square_colour(uint8_t x, uint8_t y, uint8_t object);
+void update_square_colour(uint8_t x, uint16_t y, uint8_t object);
 
 #endif 
\ No newline at end of file
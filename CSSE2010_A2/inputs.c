@@ -0,0 +1,188 @@
+/*
+ * inputs.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * The queue is indexed by free-running 8 bit head and tail counts, like
+ * serial1.c's buffers. Interrupt handlers don't interrupt each other, so
+ * the ones that post events never race among themselves.
+ *
+ * The buttons and switches are debounced together, one bit each, with
+ * vertical counters: bit n of count0 and count1 is a two bit count for
+ * input n, so all eight are counted with a few logic instructions. Each
+ * timer tick, an input that reads the same as its debounced state has its
+ * count reset; one that reads differently counts, and changes state when
+ * the count rolls over - after 4 ticks in a row reading the new state.
+ * The cost per tick is the same however much they bounce.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "inputs.h"
+#include "buttons.h"
+#include "scheduler.h"
+#include "serial1.h"
+#include "serialio.h"
+#include "timer0.h"
+
+#define QUEUE_MASK (INPUT_QUEUE_SIZE - 1)
+
+// The buttons are on pins B0 to B3, and the speed switch and the two
+// destination switches on pins D4 to D6, so they share a byte as they are
+#define BUTTON_PINS 0x0F
+#define SWITCH_PINS_SHIFT 4
+#define SWITCH_PINS (0b111<<SWITCH_PINS_SHIFT)
+
+static InputEvent queue[INPUT_QUEUE_SIZE];
+static volatile uint8_t head;
+static volatile uint8_t tail;
+static volatile uint16_t dropped;
+
+static volatile uint8_t switches;
+static uint8_t input_task;
+static uint8_t started;
+
+// Debounced state of the buttons and switches, and their vertical counters
+static uint8_t debounced;
+static uint8_t count0;
+static uint8_t count1;
+
+// The buttons and port 1 keep queues of their own, so only need to say
+// that there is something to read - with a flag each (a bit for each
+// InputType) rather than a place in this queue
+static volatile uint8_t waiting;
+static volatile uint32_t waiting_time[INPUT_NUM_TYPES];
+
+static uint8_t read_pins(void) {
+	return (PINB & BUTTON_PINS) | (PIND & SWITCH_PINS);
+}
+
+static void sample_pins(void);
+
+void init_inputs(void) {
+	head = 0;
+	tail = 0;
+	dropped = 0;
+	waiting = 0;
+	started = 0;
+	debounced = read_pins();
+	count0 = 0xFF;
+	count1 = 0xFF;
+	switches = debounced >> SWITCH_PINS_SHIFT;
+	init_buttons();
+	set_tick_handler(sample_pins);
+}
+
+// Only called from interrupt handlers
+static uint8_t post(uint8_t type, uint8_t value) {
+	uint8_t h = head;
+	if((uint8_t)(h - tail) >= INPUT_QUEUE_SIZE) {
+		dropped++;
+		return 0;
+	}
+	InputEvent* event = &queue[h & QUEUE_MASK];
+	event->type = type;
+	event->value = value;
+	event->time = get_current_time();
+	head = h + 1;
+	scheduler_trigger(input_task);
+	return 1;
+}
+
+// Only called from interrupt handlers (or with interrupts off)
+static void post_waiting(uint8_t type) {
+	if(!(waiting & (1<<type))) {
+		waiting_time[type] = get_current_time();
+		waiting |= (1<<type);
+	}
+	scheduler_trigger(input_task);
+}
+
+static void post_buttons(void) {
+	post_waiting(INPUT_BUTTONS);
+}
+
+static uint8_t post_key(char c) {
+	return post(INPUT_KEY, c);
+}
+
+static void post_serial1(void) {
+	post_waiting(INPUT_SERIAL1);
+}
+
+void inputs_start(uint8_t task) {
+	input_task = task;
+	started = 1;
+	set_button_handler(post_buttons);
+	serial_set_input_handler(post_key);
+	serial1_set_input_handler(post_serial1);
+
+	// Button events and characters that came before the handlers were
+	// set won't announce themselves (reading the buttons when there is
+	// nothing there costs next to nothing)
+	cli();
+	post_waiting(INPUT_BUTTONS);
+	if(serial1_input_available()) {
+		post_waiting(INPUT_SERIAL1);
+	}
+	sei();
+}
+
+uint8_t input_get(InputEvent* event) {
+	uint8_t t = tail;
+	if(t != head) {
+		*event = queue[t & QUEUE_MASK];
+		tail = t + 1;
+		return 1;
+	}
+	for(uint8_t type = 0; type < INPUT_NUM_TYPES; type++) {
+		if(waiting & (1<<type)) {
+			// Cleared first so that anything arriving from here on
+			// posts another event
+			cli();
+			event->time = waiting_time[type];
+			waiting &= ~(1<<type);
+			sei();
+			event->type = type;
+			event->value = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+uint8_t input_switches(void) {
+	return switches;
+}
+
+uint16_t input_dropped(void) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint16_t count = dropped;
+	if(interrupts_enabled) {
+		sei();
+	}
+	return count;
+}
+
+// Tick handler - runs in the timer interrupt
+static void sample_pins(void) {
+	uint8_t changed = debounced ^ read_pins();
+	// Count down from 3 the inputs that differ, and reset the rest. The
+	// inputs at 0 before this count roll over and change.
+	count0 = ~(count0 & changed);
+	count1 = count0 ^ (count1 & changed);
+	changed &= count0 & count1;
+	debounced ^= changed;
+
+	// The buttons are timed while they are held, so hear every tick
+	buttons_update(debounced & BUTTON_PINS);
+	if(changed & SWITCH_PINS) {
+		switches = debounced >> SWITCH_PINS_SHIFT;
+		if(started) {
+			post(INPUT_SWITCHES, switches);
+		}
+	}
+}
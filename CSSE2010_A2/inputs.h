@@ -0,0 +1,80 @@
+/*
+ * inputs.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * One queue of input events, filled by the interrupt handlers that see
+ * them - button events (buttons.h), characters from the terminal
+ * (serialio.c), the switches on pins D4 to D6 changing and characters
+ * arriving on serial port 1 (serial1.c). Each event is stamped with the
+ * time it happened and triggers the scheduler task that reads the queue,
+ * so nothing needs to poll for input while there is none.
+ *
+ * The buttons and switches are sampled every timer tick (timer0.h) and
+ * debounced here: a button or switch has to read the same for 4 ticks in a
+ * row (about 8ms) before its change counts, so a bouncing contact gives
+ * one press (or change) rather than several.
+ *
+ * The queue is written only by interrupt handlers and read only by the
+ * main program, so reading it doesn't disable interrupts.
+ */
+
+#ifndef INPUTS_H_
+#define INPUTS_H_
+
+#include <stdint.h>
+
+// Must be a power of 2
+#define INPUT_QUEUE_SIZE 16
+
+// Switch bits, as returned by input_switches()
+#define SWITCH_SPEED (1<<0)
+#define SWITCH_DESTINATION_SHIFT 1
+#define SWITCH_DESTINATION_MASK (0b11<<SWITCH_DESTINATION_SHIFT)
+
+typedef enum {
+	INPUT_BUTTONS,		// there are events to read with button_event()
+	INPUT_KEY,			// value is the character typed on the terminal
+	INPUT_SWITCHES,		// value is the switches (as input_switches())
+	INPUT_SERIAL1,		// there are characters to read from serial port 1
+	INPUT_NUM_TYPES
+} InputType;
+
+typedef struct {
+	uint8_t type;
+	uint8_t value;
+	uint32_t time;		// ms, when the interrupt handler saw it
+} InputEvent;
+
+/* Start sampling the buttons and switches (and set up buttons.h), taking
+ * their state now as debounced. Timer 0 must have been set up first. It is
+ * assumed that global interrupts are off when this function is called.
+ */
+void init_inputs(void);
+
+/* Send all input to the queue from now on, triggering the given scheduler
+ * task (which must have a period of 0) for each event. Anything typed on
+ * the terminal or pushed before this is still read from serialio.h and
+ * buttons.h as usual.
+ */
+void inputs_start(uint8_t task);
+
+/* Take the oldest event off the queue. Returns 0 if there are none.
+ * There is at most one INPUT_BUTTONS and one INPUT_SERIAL1 event waiting at
+ * a time, and they come after the rest - they mean button_event() or
+ * serial1_get_char() should be called until there is nothing more to read.
+ * Their time is when the first of what is waiting arrived.
+ */
+uint8_t input_get(InputEvent* event);
+
+/* The switches as they are now: SWITCH_SPEED and the destination in
+ * SWITCH_DESTINATION_MASK.
+ */
+uint8_t input_switches(void);
+
+/* Events thrown away because the queue was full (wraps). A character from
+ * the terminal that doesn't fit also counts as a serial input overrun.
+ */
+uint16_t input_dropped(void);
+
+#endif /* INPUTS_H_ */
@@ -17,6 +17,37 @@
 #define CMD_SHIFT_DISPLAY 0x04
 #define CMD_CLEAR_SCREEN 0x0F
 
+#define SHIFT_RIGHT 0x01
+#define SHIFT_LEFT 0x02
+#define SHIFT_DOWN 0x04
+#define SHIFT_UP 0x08
+
+// Length in bytes of each command
+#define PIXEL_BYTES 3
+#define ROW_BYTES (2 + MATRIX_NUM_COLUMNS)
+#define COL_BYTES (2 + MATRIX_NUM_ROWS)
+#define SHIFT_BYTES 2
+
+// Only look for a shift of the whole image when at least this many pixels
+// have changed
+#define SHIFT_MIN_CHANGES 6
+
+// Copies of the image the display should be showing (frame) and of the
+// image that has been sent to it (shown). Pixels written with
+// ledmatrix_set_pixel() only change frame. Bit y of dirty[x] is set while
+// frame and shown differ at pixel (x,y). ledmatrix_flush() works out the
+// cheapest set of commands that will bring shown up to date.
+static MatrixData frame;
+static MatrixData shown;
+static uint8_t dirty[MATRIX_NUM_COLUMNS];
+
+// Flush statistics. Bytes saved are counted against sending one pixel
+// command per changed pixel.
+static uint32_t flush_bytes_sent;
+static int32_t flush_bytes_saved;
+static int16_t frame_bytes_saved;
+static int16_t last_frame_bytes_saved;
+
 void ledmatrix_setup(void) {
 	// Setup SPI - we divide the clock by 128.
 	// (This speed guarantees the SPI buffer will never overflow on
@@ -24,12 +55,30 @@ void ledmatrix_setup(void) {
 	spi_setup_master(128);
 }
 
+// Commands are added to the SPI transmit queue and sent in the background.
+// If the queue doesn't have room for the whole command we wait until it
+// does, so callers that write a lot at once are held back to the speed of
+// the SPI link.
+static void send_command(const uint8_t* bytes, uint8_t length) {
+	while(spi_queue_space() < length) {
+		; // wait
+	}
+	(void)spi_queue_bytes(bytes, length);
+}
+
 void ledmatrix_update_all(MatrixData data) {
-	(void)spi_send_byte(CMD_UPDATE_ALL);
+	// Too long for the queue in one go, so the data is sent a row at a time
+	uint8_t command = CMD_UPDATE_ALL;
+	send_command(&command, 1);
 	for(uint8_t y=0; y<MATRIX_NUM_ROWS; y++) {
+		MatrixRow row;
 		for(uint8_t x=0; x<MATRIX_NUM_COLUMNS; x++) {
-			(void)spi_send_byte(data[x][y]);
+			row[x] = frame[x][y] = shown[x][y] = data[x][y];
 		}
+		send_command(row, MATRIX_NUM_COLUMNS);
+	}
+	for(uint8_t x=0; x<MATRIX_NUM_COLUMNS; x++) {
+		dirty[x] = 0;
 	}
 }
 
@@ -38,9 +87,10 @@ void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
 		// Position isn't valid - we ignore the request.
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_PIXEL);
-	(void)spi_send_byte( ((y & 0x07)<<4) | (x & 0x0F));
-	(void)spi_send_byte(pixel);
+	frame[x][y] = shown[x][y] = pixel;
+	dirty[x] &= ~(1<<y);
+	uint8_t command[PIXEL_BYTES] = { CMD_UPDATE_PIXEL, ((y & 0x07)<<4) | (x & 0x0F), pixel };
+	send_command(command, PIXEL_BYTES);
 }
 
 void ledmatrix_update_row(uint8_t y, MatrixRow row) {
@@ -48,11 +98,14 @@ void ledmatrix_update_row(uint8_t y, MatrixRow row) {
 		// y value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_ROW);
-	(void)spi_send_byte(y & 0x07);	// row number
+	uint8_t command[ROW_BYTES];
+	command[0] = CMD_UPDATE_ROW;
+	command[1] = y & 0x07;	// row number
 	for(uint8_t x = 0; x<MATRIX_NUM_COLUMNS; x++) {
-		(void)spi_send_byte(row[x]);
+		command[2 + x] = frame[x][y] = shown[x][y] = row[x];
+		dirty[x] &= ~(1<<y);
 	}
+	send_command(command, ROW_BYTES);
 }
 
 void ledmatrix_update_column(uint8_t x, MatrixColumn col) {
@@ -60,35 +113,358 @@ void ledmatrix_update_column(uint8_t x, MatrixColumn col) {
 		// x value is too large - we ignore the request
 		return;
 	}
-	(void)spi_send_byte(CMD_UPDATE_COL);
-	(void)spi_send_byte(x & 0x0F); // column number
+	uint8_t command[COL_BYTES];
+	command[0] = CMD_UPDATE_COL;
+	command[1] = x & 0x0F; // column number
 	for(uint8_t y = 0; y<MATRIX_NUM_ROWS; y++) {
-		(void)spi_send_byte(col[y]);
+		command[2 + y] = frame[x][y] = shown[x][y] = col[y];
 	}
+	dirty[x] = 0;
+	send_command(command, COL_BYTES);
+}
+
+// Shift an image in place the way the display would shift it
+static void shift_image(MatrixData image, uint8_t direction) {
+	switch(direction) {
+		case SHIFT_LEFT:
+			for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS - 1; x++) {
+				copy_matrix_column(image[x+1], image[x]);
+			}
+			set_matrix_column_to_colour(image[MATRIX_NUM_COLUMNS-1], COLOUR_BLACK);
+			break;
+		case SHIFT_RIGHT:
+			for(uint8_t x = MATRIX_NUM_COLUMNS - 1; x > 0; x--) {
+				copy_matrix_column(image[x-1], image[x]);
+			}
+			set_matrix_column_to_colour(image[0], COLOUR_BLACK);
+			break;
+		case SHIFT_UP:
+			for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				for(uint8_t y = MATRIX_NUM_ROWS - 1; y > 0; y--) {
+					image[x][y] = image[x][y-1];
+				}
+				image[x][0] = COLOUR_BLACK;
+			}
+			break;
+		default:
+			for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				for(uint8_t y = 0; y < MATRIX_NUM_ROWS - 1; y++) {
+					image[x][y] = image[x][y+1];
+				}
+				image[x][MATRIX_NUM_ROWS-1] = COLOUR_BLACK;
+			}
+			break;
+	}
+}
+
+// Recalculate every dirty bit by comparing frame with shown
+static void update_dirty(void) {
+	for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		uint8_t bits = 0;
+		for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+			if(frame[x][y] != shown[x][y]) {
+				bits |= (1<<y);
+			}
+		}
+		dirty[x] = bits;
+	}
+}
+
+// Both copies of the image move with the display, so any changes not yet
+// sent move too
+static void shift_display(uint8_t direction) {
+	shift_image(frame, direction);
+	shift_image(shown, direction);
+	update_dirty();
+	uint8_t command[SHIFT_BYTES] = { CMD_SHIFT_DISPLAY, direction };
+	send_command(command, SHIFT_BYTES);
 }
 
 void ledmatrix_shift_display_left(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x02);
+	shift_display(SHIFT_LEFT);
 }
 
 void ledmatrix_shift_display_right(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x01);
+	shift_display(SHIFT_RIGHT);
 }
 
 void ledmatrix_shift_display_up(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x08);
+	shift_display(SHIFT_UP);
 }
 
 void ledmatrix_shift_display_down(void) {
-	(void)spi_send_byte(CMD_SHIFT_DISPLAY);
-	(void)spi_send_byte(0x04);
+	shift_display(SHIFT_DOWN);
 }
 
 void ledmatrix_clear(void) {
-	(void)spi_send_byte(CMD_CLEAR_SCREEN);
+	for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		set_matrix_column_to_colour(frame[x], COLOUR_BLACK);
+		set_matrix_column_to_colour(shown[x], COLOUR_BLACK);
+		dirty[x] = 0;
+	}
+	uint8_t command = CMD_CLEAR_SCREEN;
+	send_command(&command, 1);
+}
+
+void ledmatrix_set_pixel(uint8_t x, uint8_t y, PixelColour pixel) {
+	if(x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return;
+	}
+	frame[x][y] = pixel;
+	if(pixel != shown[x][y]) {
+		dirty[x] |= (1<<y);
+	} else {
+		dirty[x] &= ~(1<<y);
+	}
+}
+
+PixelColour ledmatrix_get_pixel(uint8_t x, uint8_t y) {
+	if(x >= MATRIX_NUM_COLUMNS || y >= MATRIX_NUM_ROWS) {
+		return COLOUR_BLACK;
+	}
+	return frame[x][y];
+}
+
+/*
+ * Flush planning.
+ *
+ * A pixel command costs 3 bytes, a column 10 and a row 18. Once the set of
+ * rows to send is chosen, each column is best sent either whole or as
+ * separate pixels, whichever is cheaper, so the plan comes down to choosing
+ * the rows. A row is only worth sending if it has at least 7 dirty pixels
+ * (each pixel it covers saves at most 3 bytes elsewhere), so usually only a
+ * few rows are candidates. With up to 5 candidates every combination is
+ * tried; with more (most of the display changing) we improve on the better
+ * of "none" and "all" one row at a time. A whole-display update (129 bytes)
+ * would not fit in the SPI queue and is at most 15 bytes cheaper than
+ * sending every row, so it is not used.
+ *
+ * When many pixels have changed we also check whether shifting the display
+ * one place in any direction, and then patching it up, would be cheaper.
+ */
+
+#define MAX_EXACT_CANDIDATES 5
+
+static uint8_t count_bits(uint8_t bits) {
+	uint8_t count = 0;
+	while(bits) {
+		bits &= bits - 1;
+		count++;
+	}
+	return count;
+}
+
+// Bytes needed to send the dirty pixels in bits once the rows in row_mask
+// have been sent
+static uint16_t plan_cost(const uint8_t* bits, uint8_t row_mask) {
+	uint16_t cost = count_bits(row_mask) * ROW_BYTES;
+	for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		uint8_t pixels_cost = count_bits(bits[x] & ~row_mask) * PIXEL_BYTES;
+		cost += pixels_cost < COL_BYTES ? pixels_cost : COL_BYTES;
+	}
+	return cost;
+}
+
+// Choose the rows to send for the dirty pixels in bits. Returns the total
+// cost in bytes of the plan; the rows are returned in row_mask.
+static uint16_t plan_rows(const uint8_t* bits, uint8_t* row_mask) {
+	uint8_t candidates = 0;
+	uint8_t num_candidates = 0;
+	for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		uint8_t count = 0;
+		for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			count += (bits[x] >> y) & 1;
+		}
+		if(count * PIXEL_BYTES > ROW_BYTES) {
+			candidates |= (1<<y);
+			num_candidates++;
+		}
+	}
+
+	uint8_t best_mask = 0;
+	uint16_t best_cost = plan_cost(bits, 0);
+	if(num_candidates <= MAX_EXACT_CANDIDATES) {
+		// Try every non-empty subset of the candidates
+		for(uint8_t mask = candidates; mask; mask = (mask - 1) & candidates) {
+			uint16_t cost = plan_cost(bits, mask);
+			if(cost < best_cost) {
+				best_cost = cost;
+				best_mask = mask;
+			}
+		}
+	} else {
+		uint16_t cost = plan_cost(bits, candidates);
+		if(cost < best_cost) {
+			best_cost = cost;
+			best_mask = candidates;
+		}
+		uint8_t improved = 1;
+		while(improved) {
+			improved = 0;
+			for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+				if(candidates & (1<<y)) {
+					cost = plan_cost(bits, best_mask ^ (1<<y));
+					if(cost < best_cost) {
+						best_cost = cost;
+						best_mask ^= (1<<y);
+						improved = 1;
+					}
+				}
+			}
+		}
+	}
+	*row_mask = best_mask;
+	return best_cost;
+}
+
+// Colour pixel (x,y) of the display would have after the given shift
+static PixelColour shifted_pixel(uint8_t direction, uint8_t x, uint8_t y) {
+	switch(direction) {
+		case SHIFT_LEFT:
+			return x < MATRIX_NUM_COLUMNS - 1 ? shown[x+1][y] : COLOUR_BLACK;
+		case SHIFT_RIGHT:
+			return x > 0 ? shown[x-1][y] : COLOUR_BLACK;
+		case SHIFT_UP:
+			return y > 0 ? shown[x][y-1] : COLOUR_BLACK;
+		default:
+			return y < MATRIX_NUM_ROWS - 1 ? shown[x][y+1] : COLOUR_BLACK;
+	}
+}
+
+// Shift direction (if any) that makes the display cheapest to bring up to
+// date. cost holds the cost without a shift and is lowered if a shift wins.
+static uint8_t plan_shift(uint16_t* cost) {
+	uint8_t best_shift = 0;
+	for(uint8_t direction = SHIFT_RIGHT; direction <= SHIFT_UP; direction <<= 1) {
+		uint8_t bits[MATRIX_NUM_COLUMNS];
+		for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+			bits[x] = 0;
+			for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+				if(shifted_pixel(direction, x, y) != frame[x][y]) {
+					bits[x] |= (1<<y);
+				}
+			}
+		}
+		uint8_t row_mask;
+		uint16_t shift_cost = SHIFT_BYTES + plan_rows(bits, &row_mask);
+		if(shift_cost < *cost) {
+			*cost = shift_cost;
+			best_shift = direction;
+		}
+	}
+	return best_shift;
+}
+
+static uint8_t count_dirty(void) {
+	uint8_t count = 0;
+	for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		count += count_bits(dirty[x]);
+	}
+	return count;
+}
+
+// Queue a command that brings the given number of dirty pixels up to date
+// and record how many bytes it saved. Returns 0 if the SPI queue has no
+// room for it.
+static uint8_t flush_command(const uint8_t* command, uint8_t length, int16_t pixels) {
+	if(!spi_queue_bytes(command, length)) {
+		return 0;
+	}
+	flush_bytes_sent += length;
+	frame_bytes_saved += pixels * PIXEL_BYTES - length;
+	return 1;
+}
+
+uint8_t ledmatrix_flush(void) {
+	uint8_t changed = count_dirty();
+	if(changed == 0) {
+		return 1;
+	}
+
+	uint8_t row_mask;
+	uint16_t cost = plan_rows(dirty, &row_mask);
+
+	// If the whole image has moved, shifting the display may be cheaper
+	if(changed >= SHIFT_MIN_CHANGES) {
+		uint8_t direction = plan_shift(&cost);
+		if(direction) {
+			if(spi_queue_space() < SHIFT_BYTES) {
+				return 0;
+			}
+			uint8_t command[SHIFT_BYTES] = { CMD_SHIFT_DISPLAY, direction };
+			shift_image(shown, direction);
+			update_dirty();
+			(void)flush_command(command, SHIFT_BYTES, (int16_t)changed - count_dirty());
+			(void)plan_rows(dirty, &row_mask);
+		}
+	}
+
+	// Rows first, then whole columns, then single pixels. If the SPI queue
+	// fills up we stop - what is left is still dirty and is planned again
+	// on the next call.
+	for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+		if(row_mask & (1<<y)) {
+			uint8_t command[ROW_BYTES];
+			uint8_t pixels = 0;
+			command[0] = CMD_UPDATE_ROW;
+			command[1] = y;
+			for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				command[2 + x] = frame[x][y];
+				pixels += (dirty[x] >> y) & 1;
+			}
+			if(!flush_command(command, ROW_BYTES, pixels)) {
+				return 0;
+			}
+			for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+				shown[x][y] = frame[x][y];
+				dirty[x] &= ~(1<<y);
+			}
+		}
+	}
+	for(uint8_t x = 0; x < MATRIX_NUM_COLUMNS; x++) {
+		uint8_t pixels = count_bits(dirty[x]);
+		if(pixels * PIXEL_BYTES > COL_BYTES) {
+			uint8_t command[COL_BYTES];
+			command[0] = CMD_UPDATE_COL;
+			command[1] = x;
+			for(uint8_t y = 0; y < MATRIX_NUM_ROWS; y++) {
+				command[2 + y] = frame[x][y];
+			}
+			if(!flush_command(command, COL_BYTES, pixels)) {
+				return 0;
+			}
+			copy_matrix_column(frame[x], shown[x]);
+			dirty[x] = 0;
+		}
+		for(uint8_t y = 0; dirty[x]; y++) {
+			if(dirty[x] & (1<<y)) {
+				uint8_t command[PIXEL_BYTES] = { CMD_UPDATE_PIXEL, (y<<4) | x, frame[x][y] };
+				if(!flush_command(command, PIXEL_BYTES, 1)) {
+					return 0;
+				}
+				shown[x][y] = frame[x][y];
+				dirty[x] &= ~(1<<y);
+			}
+		}
+	}
+
+	// The frame is complete
+	flush_bytes_saved += frame_bytes_saved;
+	last_frame_bytes_saved = frame_bytes_saved;
+	frame_bytes_saved = 0;
+	return 1;
+}
+
+uint32_t ledmatrix_flush_bytes_sent(void) {
+	return flush_bytes_sent;
+}
+
+int32_t ledmatrix_flush_bytes_saved(void) {
+	return flush_bytes_saved;
+}
+
+int16_t ledmatrix_last_frame_bytes_saved(void) {
+	return last_frame_bytes_saved;
 }
 
 void copy_matrix_column(MatrixColumn from, MatrixColumn to) {
@@ -31,6 +31,9 @@ void ledmatrix_setup(void);
 // For those functions which take an x or a y value, the value must be valid
 // or the request will be ignored. (i.e. x must be < MATRIX_NUM_COLUMNS
 // and y must be < MATRIX_NUM_ROWS)
+// Commands are queued and sent over SPI by interrupt, so these functions
+// return before the display changes. They only wait if the SPI transmit
+// queue is full. Interrupts must be enabled.
 void ledmatrix_update_all(MatrixData data);
 void ledmatrix_update_pixel(uint8_t x, uint8_t y, PixelColour pixel);
 void ledmatrix_update_row(uint8_t y, MatrixRow row);
@@ -41,6 +44,25 @@ void ledmatrix_shift_display_up(void);
 void ledmatrix_shift_display_down(void);
 void ledmatrix_clear(void);
 
+// Buffered drawing. ledmatrix_set_pixel() only updates a copy of the image
+// held in RAM and notes the pixel as changed if its colour is different
+// from what the display shows. ledmatrix_flush() picks the combination of
+// pixel, row, column and shift commands that brings the display up to date
+// in the fewest bytes and queues as much of it as fits in the SPI transmit
+// queue without waiting. It returns 1 if nothing is left to send (0 if it
+// should be called again later). The functions above keep the RAM copy up
+// to date too, so the two styles can be mixed.
+void ledmatrix_set_pixel(uint8_t x, uint8_t y, PixelColour pixel);
+PixelColour ledmatrix_get_pixel(uint8_t x, uint8_t y);
+uint8_t ledmatrix_flush(void);
+
+// Flush statistics - total bytes queued by ledmatrix_flush(), and the bytes
+// saved compared with sending each changed pixel on its own, in total and
+// for the last complete frame.
+uint32_t ledmatrix_flush_bytes_sent(void);
+int32_t ledmatrix_flush_bytes_saved(void);
+int16_t ledmatrix_last_frame_bytes_saved(void);
+
 // Functions to operate on MatrixRow and MatrixColumn data structures
 void copy_matrix_column(MatrixColumn from, MatrixColumn to);
 void copy_matrix_row(MatrixRow from, MatrixRow to);
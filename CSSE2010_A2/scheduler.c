@@ -0,0 +1,230 @@
+/*
+ * scheduler.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "scheduler.h"
+#include "timer0.h"
+
+typedef struct {
+	TaskFunction run;
+	uint16_t period;
+	uint16_t deadline;
+	uint8_t priority;
+	uint32_t release;	// when the task is next due (ms)
+	TaskStats stats;
+} Task;
+
+static Task tasks[SCHEDULER_MAX_TASKS];
+static uint8_t num_tasks;
+static MissHandler miss_handler;
+
+// Tasks that have been triggered (a bit for each) and when
+static volatile uint8_t triggered;
+static volatile uint32_t trigger_time[SCHEDULER_MAX_TASKS];
+
+static LoopStats loop_stats;
+static uint32_t last_call_us;	// when scheduler_run_once() last ran a task
+static uint8_t last_call_ran;
+// Start of the interval loop_stats.per_second is being counted over
+static uint32_t window_start;
+static uint32_t window_iterations;
+
+void scheduler_init(void) {
+	num_tasks = 0;
+	miss_handler = 0;
+	triggered = 0;
+	loop_stats.iterations = 0;
+	loop_stats.per_second = 0;
+	loop_stats.max_period_us = 0;
+	last_call_ran = 0;
+	window_start = get_current_time();
+	window_iterations = 0;
+}
+
+void scheduler_set_miss_handler(MissHandler handler) {
+	miss_handler = handler;
+}
+
+uint8_t scheduler_add_task(TaskFunction run, uint16_t period,
+		uint16_t deadline, uint8_t priority) {
+	if(num_tasks >= SCHEDULER_MAX_TASKS) {
+		return SCHEDULER_NO_TASK;
+	}
+	Task* task = &tasks[num_tasks];
+	task->run = run;
+	task->period = period;
+	task->deadline = deadline;
+	task->priority = priority;
+	task->release = get_current_time() + task->period;
+	task->stats.runs = 0;
+	task->stats.misses = 0;
+	task->stats.skipped = 0;
+	task->stats.total_us = 0;
+	task->stats.min_us = 0xFFFF;
+	task->stats.max_us = 0;
+	task->stats.max_lateness = 0;
+	for(uint8_t i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS; i++) {
+		task->stats.histogram[i] = 0;
+	}
+	return num_tasks++;
+}
+
+void scheduler_set_period(uint8_t task, uint16_t period) {
+	if(task < num_tasks) {
+		tasks[task].period = period ? period : 1;
+	}
+}
+
+void scheduler_trigger(uint8_t task) {
+	if(task >= num_tasks) {
+		return;
+	}
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	if(!(triggered & (1<<task))) {
+		trigger_time[task] = get_current_time();
+		triggered |= (1<<task);
+	}
+	if(interrupts_enabled) {
+		sei();
+	}
+}
+
+// Counts an iteration of the loop that calls scheduler_run_once()
+static void count_iteration(uint32_t now) {
+	loop_stats.iterations++;
+	if(last_call_ran) {
+		uint32_t period_us = get_current_time_us() - last_call_us;
+		if(period_us > loop_stats.max_period_us) {
+			loop_stats.max_period_us = period_us;
+		}
+	}
+	uint32_t window = now - window_start;
+	if(window >= 1000) {
+		loop_stats.per_second = (loop_stats.iterations - window_iterations) *
+				1000 / window;
+		window_start = now;
+		window_iterations = loop_stats.iterations;
+	}
+}
+
+static void count_run(TaskStats* stats, uint32_t elapsed_us) {
+	uint16_t us = elapsed_us > 0xFFFF ? 0xFFFF : elapsed_us;
+	stats->runs++;
+	stats->total_us += elapsed_us;
+	if(us < stats->min_us) {
+		stats->min_us = us;
+	}
+	if(us > stats->max_us) {
+		stats->max_us = us;
+	}
+	uint8_t bucket = 0;
+	for(uint16_t limit = SCHEDULER_HISTOGRAM_US; elapsed_us >= limit &&
+			bucket < SCHEDULER_HISTOGRAM_BUCKETS - 1; limit <<= 1) {
+		bucket++;
+	}
+	if(stats->histogram[bucket] != 0xFFFF) {
+		stats->histogram[bucket]++;
+	}
+}
+
+uint8_t scheduler_run_once(void) {
+	uint32_t now = get_current_time();
+	uint8_t pending = triggered;
+	count_iteration(now);
+	last_call_ran = 0;
+
+	// Highest priority task that is due. Times are compared by their
+	// difference so that the clock wrapping round doesn't matter.
+	Task* next = 0;
+	for(uint8_t i = 0; i < num_tasks; i++) {
+		Task* task = &tasks[i];
+		uint8_t due = task->period ? (int32_t)(now - task->release) >= 0 :
+				(pending & (1<<i)) != 0;
+		if(due && (!next || task->priority < next->priority)) {
+			next = task;
+		}
+	}
+	if(!next) {
+		return 0;
+	}
+
+	// A triggered task is released when it was triggered. It can be
+	// triggered again from now on, while it runs.
+	if(!next->period) {
+		uint8_t i = next - tasks;
+		cli();
+		next->release = trigger_time[i];
+		triggered &= ~(1<<i);
+		sei();
+	}
+
+	last_call_us = get_current_time_us();
+	last_call_ran = 1;
+	uint16_t start = get_fast_time();
+	next->run(next->release);
+	uint32_t elapsed_us = FAST_TIME_US(fast_time_since(start));
+	uint32_t finish = get_current_time();
+
+	TaskStats* stats = &next->stats;
+	count_run(stats, elapsed_us);
+	uint32_t lateness = now - next->release;
+	if(lateness > stats->max_lateness) {
+		stats->max_lateness = lateness > 0xFFFF ? 0xFFFF : lateness;
+	}
+	if(finish - next->release > next->deadline) {
+		stats->misses++;
+		if(miss_handler) {
+			miss_handler(next - tasks, next->release, finish);
+		}
+	}
+
+	// Next release on the same grid, skipping any that have been missed
+	// entirely
+	if(!next->period) {
+		return 1;
+	}
+	next->release += next->period;
+	while((int32_t)(finish - next->release) >= (int32_t)next->period) {
+		next->release += next->period;
+		stats->skipped++;
+	}
+	return 1;
+}
+
+uint32_t scheduler_next_release(void) {
+	uint32_t now = get_current_time();
+	if(triggered) {
+		return now;
+	}
+	uint32_t next = now + 1000;
+	for(uint8_t i = 0; i < num_tasks; i++) {
+		if(tasks[i].period && (int32_t)(tasks[i].release - next) < 0) {
+			next = tasks[i].release;
+		}
+	}
+	return next;
+}
+
+void scheduler_idle(void) {
+	cli();
+	idle_until(scheduler_next_release());
+}
+
+const TaskStats* scheduler_task_stats(uint8_t task) {
+	return &tasks[task].stats;
+}
+
+const LoopStats* scheduler_loop_stats(void) {
+	return &loop_stats;
+}
+
+uint8_t scheduler_num_tasks(void) {
+	return num_tasks;
+}
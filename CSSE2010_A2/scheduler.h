@@ -0,0 +1,117 @@
+/*
+ * scheduler.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Cooperative scheduler for the main loop. Each task is a function that is
+ * released every period ms and must finish within deadline ms of its
+ * release. Tasks run to completion, one at a time - when several are due,
+ * the one with the highest priority (lowest number) runs first. Releases
+ * stay on a fixed grid (release time + period), so a task that starts late
+ * because another was running does not push its later releases back.
+ * A task that falls more than a whole period behind skips the releases it
+ * missed rather than running several times in a row to catch up.
+ * A task with a period of 0 isn't released by time at all, only by
+ * scheduler_trigger() (e.g. from an interrupt handler when there is work
+ * for it), and its deadline counts from the trigger.
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stdint.h>
+
+#define SCHEDULER_MAX_TASKS 8
+
+/* Returned by scheduler_add_task() when there is no room for another
+ * task. Triggering it or setting its period does nothing.
+ */
+#define SCHEDULER_NO_TASK 0xFF
+
+/* A task is passed the time (in ms) it was released, which is when it
+ * should have run.
+ */
+typedef void (*TaskFunction)(uint32_t release);
+
+// Execution times are also counted in a histogram: bucket 0 counts runs
+// shorter than SCHEDULER_HISTOGRAM_US, each bucket after that runs up to
+// twice as long as the one before, and the last bucket anything longer
+// (8ms and over)
+#define SCHEDULER_HISTOGRAM_BUCKETS 8
+#define SCHEDULER_HISTOGRAM_US 128
+
+typedef struct {
+	uint32_t runs;
+	uint32_t misses;		// runs that finished after their deadline
+	uint32_t skipped;		// releases dropped because the task was too late
+	uint64_t total_us;		// execution time of all runs
+	uint16_t min_us;		// shortest run (0xFFFF before the first)
+	uint16_t max_us;		// longest run
+	uint16_t max_lateness;	// longest time from release to start (ms)
+	uint16_t histogram[SCHEDULER_HISTOGRAM_BUCKETS];	// (stops at 0xFFFF)
+} TaskStats;
+
+typedef struct {
+	uint32_t iterations;	// calls of scheduler_run_once()
+	uint16_t per_second;	// iterations in the last second or so
+	// Longest time from one call of scheduler_run_once() that ran a task
+	// to the next call, i.e. the longest the loop was busy between checks
+	// for due tasks (us)
+	uint32_t max_period_us;
+} LoopStats;
+
+/* Called when task finishes at time finish, later than the deadline of
+ * its release at time release (both ms).
+ */
+typedef void (*MissHandler)(uint8_t task, uint32_t release, uint32_t finish);
+
+/* Remove all tasks (and the miss handler) */
+void scheduler_init(void);
+
+/* Function to call for each deadline miss (may be 0) */
+void scheduler_set_miss_handler(MissHandler handler);
+
+/* Add a task, first released period ms from now (or, with a period of 0,
+ * when it is triggered). Returns the task number to use with the functions
+ * below, or SCHEDULER_NO_TASK (and the task is never run) if
+ * SCHEDULER_MAX_TASKS tasks have already been added.
+ */
+uint8_t scheduler_add_task(TaskFunction run, uint16_t period,
+		uint16_t deadline, uint8_t priority);
+
+/* Change the period of a task (at least 1). Takes effect from its next
+ * release.
+ */
+void scheduler_set_period(uint8_t task, uint16_t period);
+
+/* Release a task with a period of 0. Can be called from interrupt
+ * handlers. Triggering a task that is already waiting to run does nothing
+ * more.
+ */
+void scheduler_trigger(uint8_t task);
+
+/* Run the highest priority task that is due, if any. Returns 1 if a task
+ * ran.
+ */
+uint8_t scheduler_run_once(void);
+
+/* Time (in ms) the next task is due - now if one has been triggered. With
+ * no tasks (that have a period), a second from now.
+ */
+uint32_t scheduler_next_release(void);
+
+/* Sleep (idle_until()) until the next task is due or an interrupt comes.
+ * Call when scheduler_run_once() has nothing to run. Interrupts are
+ * disabled while it checks for triggered tasks, so a trigger can't slip
+ * in between the check and the sleep and wait for the next release.
+ */
+void scheduler_idle(void);
+
+/* Execution time (in us, to the nearest 8us) and timing of each task, and
+ * of the loop that calls scheduler_run_once()
+ */
+const TaskStats* scheduler_task_stats(uint8_t task);
+const LoopStats* scheduler_loop_stats(void);
+uint8_t scheduler_num_tasks(void);
+
+#endif /* SCHEDULER_H_ */
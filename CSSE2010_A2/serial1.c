@@ -0,0 +1,125 @@
+/*
+ * serial1.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Output goes through a SerialOutput, as serial port 0's does. The input
+ * buffer is 256 bytes indexed by free-running 8 bit head and tail counts
+ * in the same way: the main program only moves one end and the interrupt
+ * handler the other, so neither needs interrupts disabled.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "serial1.h"
+
+#define SYSCLK 8000000L
+
+#define BUFFER_SIZE 256
+#define BUFFER_ROOM (BUFFER_SIZE - 1)
+
+static SerialOutput output;
+
+static volatile char in_buffer[BUFFER_SIZE];
+static volatile uint8_t in_head;
+static volatile uint8_t in_tail;
+static volatile uint16_t in_overruns;
+static Serial1InputHandler input_handler;
+
+void init_serial1(uint32_t baudrate) {
+	serial_output_init(&output, &UCSR1B, (1<<UDRIE1), SERIAL_DROP_NEWEST);
+	in_head = 0;
+	in_tail = 0;
+	in_overruns = 0;
+	input_handler = 0;
+
+	// Double speed - the baud rate is the clock divided by 8 * (UBRR + 1),
+	// rounded to the nearest
+	UCSR1A = (1<<U2X1);
+	UBRR1 = ((SYSCLK / (4 * baudrate)) + 1) / 2 - 1;
+	// 8 data bits, no parity, 1 stop bit
+	UCSR1C = (1<<UCSZ11)|(1<<UCSZ10);
+	UCSR1B = (1<<RXEN1)|(1<<TXEN1)|(1<<RXCIE1);
+}
+
+uint8_t serial1_input_available(void) {
+	return in_head - in_tail;
+}
+
+int16_t serial1_get_char(void) {
+	uint8_t tail = in_tail;
+	if(tail == in_head) {
+		return -1;
+	}
+	char c = in_buffer[tail];
+	in_tail = tail + 1;
+	return (uint8_t)c;
+}
+
+void serial1_set_input_handler(Serial1InputHandler handler) {
+	input_handler = handler;
+}
+
+uint16_t serial1_input_overruns(void) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint16_t count = in_overruns;
+	if(interrupts_enabled) {
+		sei();
+	}
+	return count;
+}
+
+char* serial1_reserve(uint8_t n) {
+	return serial_output_reserve(&output, n);
+}
+
+void serial1_commit(uint8_t length) {
+	serial_output_commit(&output, length);
+}
+
+uint16_t serial1_write(const void* data, uint16_t length) {
+	return serial_output_write(&output, data, length);
+}
+
+uint8_t serial1_set_output_policy(uint8_t policy) {
+	return serial_output_set_policy(&output, policy);
+}
+
+uint32_t serial1_dropped(uint8_t policy) {
+	return serial_output_dropped(&output, policy);
+}
+
+uint32_t serial1_bytes_written(void) {
+	return output.bytes_written;
+}
+
+ISR(USART1_UDRE_vect) {
+	// (Turns itself off when there is nothing left to send)
+	int16_t c = serial_output_next(&output);
+	if(c >= 0) {
+		UDR1 = c;
+	}
+}
+
+ISR(USART1_RX_vect) {
+	char c = UDR1;
+	// Lines can end with a carriage return, as on the terminal
+	if(c == '\r') {
+		c = '\n';
+	}
+	uint8_t head = in_head;
+	if((uint8_t)(head - in_tail) >= BUFFER_ROOM) {
+		in_overruns++;
+	} else {
+		in_buffer[head] = c;
+		in_head = head + 1;
+		// Only the first character needs telling about - the rest are
+		// read along with it
+		if(head == in_tail && input_handler) {
+			input_handler();
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * serial1.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Interrupt driven serial port 1 (USART1, receive on pin D2 and transmit
+ * on pin D3) for machine readable traffic - telemetry and the command
+ * protocol - at a high baud rate, so that it doesn't compete with the
+ * terminal on serial port 0.
+ *
+ * Its output works as serialio.c's does - it has a SerialOutput
+ * (serialoutput.h) of its own, with reserve, commit and write and the
+ * output policies - but doesn't go through stdio.
+ * Input is kept in a 256 byte buffer and read with serial1_get_char().
+ * Carriage returns are turned into linefeeds as they arrive, as serialio.c
+ * does.
+ * Interrupts must be enabled globally for this module to work.
+ */
+
+#ifndef SERIAL1_H_
+#define SERIAL1_H_
+
+#include <stdint.h>
+
+#include "serialio.h"
+
+#define SERIAL1_BAUD 250000UL
+
+/* Set up USART1 at the given baud rate (in double speed mode, so rates up
+ * to 500000 are available from the 8MHz clock).
+ */
+void init_serial1(uint32_t baudrate);
+
+/* Number of characters waiting to be read */
+uint8_t serial1_input_available(void);
+
+/* Next character received, or -1 if there are none */
+int16_t serial1_get_char(void);
+
+/* Characters thrown away because the input buffer was full (wraps) */
+uint16_t serial1_input_overruns(void);
+
+/* Function called (from the interrupt handler) when a character arrives
+ * and the input buffer was empty, i.e. when there is something to read
+ * again after serial1_get_char() has returned -1.
+ */
+typedef void (*Serial1InputHandler)(void);
+void serial1_set_input_handler(Serial1InputHandler handler);
+
+/* As serial_reserve(), serial_commit() and serial_write() (serialio.h),
+ * for port 1.
+ */
+char* serial1_reserve(uint8_t n);
+void serial1_commit(uint8_t length);
+uint16_t serial1_write(const void* data, uint16_t length);
+
+/* Output policy (SerialOutputPolicy) for port 1. Starts as
+ * SERIAL_DROP_NEWEST - nothing waits for this port unless it asks to.
+ * Returns the previous policy.
+ */
+uint8_t serial1_set_output_policy(uint8_t policy);
+uint32_t serial1_dropped(uint8_t policy);
+
+uint32_t serial1_bytes_written(void);
+
+#endif /* SERIAL1_H_ */
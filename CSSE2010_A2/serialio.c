@@ -2,6 +2,7 @@
  * FILE: serialio.c
  *
  * Written by Peter Sutton.
+ * Modified by Lachlan Holliday
  * 
  * Module to allow standard input/output routines to be used via 
  * serial port 0. The init_serial_stdio() method must be called before
@@ -17,43 +18,45 @@
  * input is sought, then this will block forever.
  * The function input_available() can be used to test whether there is
  * input available to read from stdin.
+ * Output can also be written straight into the buffer, without going
+ * through stdio a character at a time: serial_reserve() and
+ * serial_commit() for formatting in place, and serial_write() for
+ * copying a block of bytes.
+ * The output buffer itself is a SerialOutput (serialoutput.c), which
+ * serial port 1 uses too.
+ * What happens when the output buffer is full is chosen with
+ * serial_set_output_policy() - wait for room, or drop characters (the
+ * new ones or the oldest waiting) and count them.
  *
  */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
+#include "serialio.h"
+
 /* System clock rate in Hz. (L at the end indicates this is a long constant) */
 #define SYSCLK 8000000L
 
 /* Global variables */
-/* Circular buffer to hold outgoing characters. The insert_pos variable
- * keeps track of the position (0 to OUTPUT_BUFFER_SIZE-1) that the next
- * outgoing character should be written to. bytes_in_buffer keeps
- * count of the number of characters currently stored in the buffer 
- * (ranging from 0 to OUTPUT_BUFFER_SIZE). This number of bytes immediately
- * prior to the current insert_pos are the bytes waiting to be output.
- * If the insert_pos reaches the end of the buffer it will wrap around
- * to the beginning (assuming those bytes have been output).
- * NOTE - OUTPUT_BUFFER_SIZE can not be larger than 255 without changing
- * the type of the variables below (currently defined as 8 bit unsigned ints).
- */
-#define OUTPUT_BUFFER_SIZE 255
-volatile char out_buffer[OUTPUT_BUFFER_SIZE];
-volatile uint8_t out_insert_pos;
-volatile uint8_t bytes_in_out_buffer;
+/* Output buffer (see serialoutput.h) */
+static SerialOutput output;
+
+/* Where received characters go instead of the input buffer, if set */
+static SerialInputHandler input_handler;
 
 /* Circular buffer to hold incoming characters. Works on same principle
  * as output buffer
  */
-#define INPUT_BUFFER_SIZE 16
+#define INPUT_BUFFER_SIZE 64
 volatile char input_buffer[INPUT_BUFFER_SIZE];
 volatile uint8_t input_insert_pos;
 volatile uint8_t bytes_in_input_buffer;
-volatile uint8_t input_overrun;
+volatile uint16_t input_overruns;
 
 /* Variable to keep track of whether incoming characters are to be echoed
  * back or not.
@@ -77,11 +80,11 @@ void init_serial_stdio(long baudrate, int8_t echo) {
 	/*
 	 * Initialise our buffers
 	*/
-	out_insert_pos = 0;
-	bytes_in_out_buffer = 0;
+	serial_output_init(&output, &UCSR0B, (1<<UDRIE0), SERIAL_BLOCK);
 	input_insert_pos = 0;
 	bytes_in_input_buffer = 0;
-	input_overrun = 0;
+	input_overruns = 0;
+	input_handler = 0;
 	
 	/*
 	 * Record whether we're going to echo characters or not
@@ -122,6 +125,36 @@ int8_t serial_input_available(void) {
 	return (bytes_in_input_buffer != 0);
 }
 
+uint16_t serial_input_overruns(void) {
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	uint16_t count = input_overruns;
+	if(interrupts_enabled) {
+		sei();
+	}
+	return count;
+}
+
+/* Count of all characters placed in the output buffer by the main program
+ * (including carriage returns added before linefeeds). Used to measure how
+ * much terminal output different parts of the program produce.
+ */
+uint32_t serial_bytes_written(void) {
+	return output.bytes_written;
+}
+
+uint8_t serial_set_output_policy(uint8_t policy) {
+	return serial_output_set_policy(&output, policy);
+}
+
+uint32_t serial_dropped(uint8_t policy) {
+	return serial_output_dropped(&output, policy);
+}
+
+void serial_set_input_handler(SerialInputHandler handler) {
+	input_handler = handler;
+}
+
 void clear_serial_input_buffer(void) {
 	/* Just adjust our buffer data so it looks empty */
 	input_insert_pos = 0;
@@ -129,59 +162,36 @@ void clear_serial_input_buffer(void) {
 }
 
 static int uart_put_char(char c, FILE* stream) {
-	uint8_t interrupts_enabled;
-	
-	/* Add the character to the buffer for transmission (if there 
-	 * is space to do so). If not we wait until the buffer has space.
-	 * If the character is \n, we output \r (carriage return)
+	/* If the character is \n, we output \r (carriage return)
 	 * also.
 	*/
 	if(c == '\n') {
 		uart_put_char('\r', stream);
 	}
 	
-	/* If the buffer is full and interrupts are disabled then we
-	 * abort - we don't output the character since the buffer will
-	 * never be emptied if interrupts are disabled. If the buffer is full
-	 * and interrupts are enabled then we loop until the buffer has 
-	 * enough space. The bytes_in_buffer variable will get modified by the
-	 * ISR which extracts bytes from the buffer.
+	/* If the buffer is full then depending on the output policy we
+	 * either loop until the buffer has enough space, drop the oldest
+	 * character in the buffer, or abort and don't output the character.
+	 * We also abort when blocking if interrupts are disabled, since the
+	 * buffer will never be emptied.
 	*/
-	interrupts_enabled = bit_is_set(SREG, SREG_I);
-	while(bytes_in_out_buffer >= OUTPUT_BUFFER_SIZE) {
-		if(!interrupts_enabled) {
-			return 1;
-		}		
-		/* else do nothing */
-	}
-	
-	/* Add the character to the buffer for transmission if there
-	 * is space to do so. We advance the insert_pos to the next
-	 * character position. If this is beyond the end of the buffer
-	 * we wrap around back to the beginning of the buffer 
-	 * NOTE: we disable interrupts before modifying the buffer. This
-	 * prevents the ISR from modifying the buffer at the same time.
-	 * We reenable them if they were enabled when we entered the
-	 * function.
-	*/	
-	cli();
-	out_buffer[out_insert_pos++] = c;
-	bytes_in_out_buffer++;
-	if(out_insert_pos == OUTPUT_BUFFER_SIZE) {
-		/* Wrap around buffer pointer if necessary */
-		out_insert_pos = 0;
-	}
-	/* Reenable interrupts (UDR Empty interrupt may have been
-	 * disabled) - we ensure it is now enabled so that it will
-	 * fire and deal with the next character in the buffer. */
-	UCSR0B |= (1 << UDRIE0);
-	if(interrupts_enabled) {
-		sei();
-	}
-	return 0;
+	return serial_output_put(&output, c) ? 0 : 1;
+}
+
+char* serial_reserve(uint8_t n) {
+	return serial_output_reserve(&output, n);
+}
+
+void serial_commit(uint8_t length) {
+	serial_output_commit(&output, length);
+}
+
+uint16_t serial_write(const void* data, uint16_t length) {
+	return serial_output_write(&output, data, length);
 }
 
 int uart_get_char(FILE* stream) {
+	(void)stream;
 	/* Wait until we've received a character */
 	while(bytes_in_input_buffer == 0) {
 		/* do nothing */
@@ -219,37 +229,15 @@ int uart_get_char(FILE* stream) {
  */
 ISR(USART0_UDRE_vect) 
 {
-	/* Check if we have data in our buffer */
-	if(bytes_in_out_buffer > 0) {
-		/* Yes we do - remove the pending byte and output it
-		 * via the UART. The pending byte (character) is the
-		 * one which is "bytes_in_buffer" characters before the 
-		 * insert_pos (taking into account that we may 
-		 * need to wrap around to the end of the buffer).
-		 */
-		char c;
-		if(out_insert_pos - bytes_in_out_buffer < 0) {
-			/* Need to wrap around */
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer
-				+ OUTPUT_BUFFER_SIZE];
-		} else {
-			c = out_buffer[out_insert_pos - bytes_in_out_buffer];
-		}
-		/* Decrement our count of the number of bytes in the 
-		 * buffer 
-		 */
-		bytes_in_out_buffer--;
-		
-		/* Output the character via the UART */
+	/* Check if we have data in our buffer. If we do, output the
+	 * oldest character via the UART. If not, the UART Data Register
+	 * Empty interrupt is disabled because otherwise it will trigger
+	 * again immediately this ISR exits. The interrupt is reenabled
+	 * when a character is placed in the buffer.
+	 */
+	int16_t c = serial_output_next(&output);
+	if(c >= 0) {
 		UDR0 = c;
-	} else {
-		/* No data in the buffer. We disable the UART Data
-		 * Register Empty interrupt because otherwise it 
-		 * will trigger again immediately this ISR exits. 
-		 * The interrupt is reenabled when a character is
-		 * placed in the buffer.
-		 */
-		UCSR0B &= ~(1<<UDRIE0);
 	}
 }
 
@@ -265,30 +253,36 @@ ISR(USART0_RX_vect)
 	char c;
 	c = UDR0;
 		
-	if(do_echo && bytes_in_out_buffer < OUTPUT_BUFFER_SIZE) {
+	if(do_echo) {
 		/* If echoing is enabled and there is output buffer
 		 * space, echo the received character back to the UART.
-		 * (If there is no output buffer space, characters
-		 * will be lost.)
+		 * (If there is no output buffer space, or the main
+		 * program is adding to the buffer, characters will
+		 * be lost.)
 		 */
-		uart_put_char(c, 0);
+		serial_output_put_from_isr(&output, c);
+	}
+	
+	/* If the character is a carriage return, turn it into a
+	 * linefeed 
+	*/
+	if (c == '\r') {
+		c = '\n';
 	}
 	
 	/* 
-	 * Check if we have space in our buffer. If not, set the overrun
-	 * flag and throw away the character. (We never clear the 
-	 * overrun flag - it's up to the programmer to check/clear
-	 * this flag if desired.)
+	 * If there is a handler, it takes the character. Otherwise check
+	 * if we have space in our buffer. If not (or the handler has no
+	 * room), count the overrun and throw away the character. (See
+	 * serial_input_overruns().)
 	 */
-	if(bytes_in_input_buffer >= INPUT_BUFFER_SIZE) {
-		input_overrun = 1;
-	} else {
-		/* If the character is a carriage return, turn it into a
-		 * linefeed 
-		*/
-		if (c == '\r') {
-			c = '\n';
+	if(input_handler) {
+		if(!input_handler(c)) {
+			input_overruns++;
 		}
+	} else if(bytes_in_input_buffer >= INPUT_BUFFER_SIZE) {
+		input_overruns++;
+	} else {
 		
 		/* 
 		 * There is room in the input buffer 
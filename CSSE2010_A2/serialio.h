@@ -11,6 +11,7 @@
  * output by the UART as speed permits.) Interrupts must be enabled 
  * globally for this module to work (after init_serial_stdio() is called).
  *
+ * Modified by Lachlan Holliday
  */
 
 #ifndef SERIALIO_H_
@@ -18,6 +19,8 @@
 
 #include <stdint.h>
 
+#include "serialoutput.h"
+
 /* Initialise serial IO using the UART. baudrate specifies the desired
  * baud rate (e.g. 19200) and echo determines whether incoming characters
  * are echoed back to the UART output as they are received (zero means no
@@ -36,4 +39,59 @@ int8_t serial_input_available(void);
  */
 void clear_serial_input_buffer(void);
 
+/* Return the number of characters received but thrown away because the
+ * input buffer was full (wraps around at 65536). Characters are lost if
+ * they aren't read quickly enough.
+ */
+uint16_t serial_input_overruns(void);
+
+/* Function that takes each character received (from the interrupt
+ * handler), returning 0 if it has no room for it (which counts as an
+ * overrun). Carriage returns are turned into linefeeds first.
+ */
+typedef uint8_t (*SerialInputHandler)(char c);
+
+/* Send received characters to handler instead of the input buffer (or back
+ * to the buffer if handler is 0). stdin and serial_input_available() then
+ * see nothing new.
+ */
+void serial_set_input_handler(SerialInputHandler handler);
+
+/* Return the total number of characters that have been written to the
+ * serial port output since init_serial_stdio() was called.
+ */
+uint32_t serial_bytes_written(void);
+
+/* Set the policy (SerialOutputPolicy, see serialoutput.h) for all output from now on (SERIAL_BLOCK after
+ * init_serial_stdio()) and return the previous one, so that a piece of
+ * output can use a policy and then put the old one back. Dropping keeps
+ * output from ever holding up the program, but dropping characters from
+ * the middle of an escape sequence will upset the terminal - drop the
+ * oldest only for output that doesn't use them.
+ */
+uint8_t serial_set_output_policy(uint8_t policy);
+
+/* Return the number of characters dropped so far under a policy */
+uint32_t serial_dropped(uint8_t policy);
+
+/* Reserve space for n (up to SERIAL_MAX_RESERVE) bytes of output and
+ * return where to write them, so that output can be formatted straight
+ * into the output buffer. Makes room according to the output policy, and
+ * returns 0 (the n bytes are counted as dropped) if it can't. Must be
+ * followed by serial_commit() before any other output.
+ */
+char* serial_reserve(uint8_t n);
+
+/* Send the first length bytes written to the space from serial_reserve()
+ * (length may be less than was reserved, or 0).
+ */
+void serial_commit(uint8_t length);
+
+/* Send length bytes exactly as they are (no carriage returns are added
+ * before linefeeds), bypassing stdio. When the buffer fills, what happens
+ * depends on the output policy; any bytes that don't fit are dropped.
+ * Returns the number of bytes sent.
+ */
+uint16_t serial_write(const void* data, uint16_t length);
+
 #endif /* SERIALIO_H_ */
\ No newline at end of file
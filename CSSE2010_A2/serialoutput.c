@@ -0,0 +1,191 @@
+/*
+ * serialoutput.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "serialoutput.h"
+
+#define BUFFER_MASK (SERIAL_OUTPUT_SIZE - 1)
+#define BUFFER_ROOM (SERIAL_OUTPUT_SIZE - 1)
+
+/* Stops the compiler moving writes to the buffer after the write to head
+ * that tells the interrupt handler they are there.
+ */
+#define OUTPUT_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+void serial_output_init(SerialOutput* out, volatile uint8_t* control,
+		uint8_t udr_empty_enable, uint8_t policy) {
+	out->head = 0;
+	out->tail = 0;
+	out->busy = 0;
+	out->policy = policy;
+	for(uint8_t i = 0; i < SERIAL_NUM_POLICIES; i++) {
+		out->dropped[i] = 0;
+	}
+	out->bytes_written = 0;
+	out->control = control;
+	out->udr_empty_enable = udr_empty_enable;
+}
+
+uint8_t serial_output_set_policy(SerialOutput* out, uint8_t policy) {
+	uint8_t previous = out->policy;
+	if(policy < SERIAL_NUM_POLICIES) {
+		out->policy = policy;
+	}
+	return previous;
+}
+
+uint32_t serial_output_dropped(const SerialOutput* out, uint8_t policy) {
+	return policy < SERIAL_NUM_POLICIES ? out->dropped[policy] : 0;
+}
+
+/* Free space in the buffer */
+static uint8_t room(const SerialOutput* out) {
+	return BUFFER_ROOM - (uint8_t)(out->head - out->tail);
+}
+
+/* Make sure there are at least n bytes free in the buffer, according to
+ * the output policy. Returns 0 if there aren't (and the n new bytes should
+ * be dropped).
+ */
+static uint8_t make_room(SerialOutput* out, uint8_t n) {
+	uint8_t free = room(out);
+	if(free >= n) {
+		return 1;
+	}
+	uint8_t interrupts_enabled = bit_is_set(SREG, SREG_I);
+	switch(out->policy) {
+		case SERIAL_DROP_OLDEST:
+			/* Throw away the oldest bytes waiting. The interrupt handler
+			 * also moves tail, so it can't run while we do.
+			 */
+			cli();
+			free = room(out);
+			if(free < n) {
+				out->tail += n - free;
+				out->dropped[SERIAL_DROP_OLDEST] += n - free;
+			}
+			if(interrupts_enabled) {
+				sei();
+			}
+			return 1;
+		case SERIAL_BLOCK:
+			/* If interrupts are disabled the buffer will never be
+			 * emptied, so we can't wait.
+			 */
+			if(interrupts_enabled) {
+				while(room(out) < n) {
+					/* do nothing - the interrupt handler frees space */
+				}
+				return 1;
+			}
+			break;
+	}
+	out->dropped[out->policy] += n;
+	return 0;
+}
+
+/* Start sending (the UDR empty interrupt may have been disabled). Another
+ * interrupt changing UCSRnB part way through doesn't matter: the UDR empty
+ * handler only clears UDRIE once head has caught up, and setting it again
+ * just makes it check once more.
+ */
+static void start_output(SerialOutput* out) {
+	*out->control |= out->udr_empty_enable;
+}
+
+uint8_t serial_output_put(SerialOutput* out, char c) {
+	out->busy = 1;
+	if(!make_room(out, 1)) {
+		out->busy = 0;
+		return 0;
+	}
+	out->buffer[out->head & BUFFER_MASK] = c;
+	OUTPUT_BARRIER();
+	out->head++;
+	out->busy = 0;
+	out->bytes_written++;
+	start_output(out);
+	return 1;
+}
+
+uint8_t serial_output_put_from_isr(SerialOutput* out, char c) {
+	if(out->busy || room(out) == 0) {
+		return 0;
+	}
+	out->buffer[out->head & BUFFER_MASK] = c;
+	out->head++;
+	start_output(out);
+	return 1;
+}
+
+char* serial_output_reserve(SerialOutput* out, uint8_t n) {
+	if(n > SERIAL_MAX_RESERVE) {
+		return 0;
+	}
+	out->busy = 1;
+	if(!make_room(out, n)) {
+		out->busy = 0;
+		return 0;
+	}
+	return &out->buffer[out->head & BUFFER_MASK];
+}
+
+void serial_output_commit(SerialOutput* out, uint8_t length) {
+	uint8_t start = out->head & BUFFER_MASK;
+	/* Whatever went past the end of the buffer belongs at the start */
+	if(start + length > SERIAL_OUTPUT_SIZE) {
+		memcpy(out->buffer, &out->buffer[SERIAL_OUTPUT_SIZE],
+				start + length - SERIAL_OUTPUT_SIZE);
+	}
+	OUTPUT_BARRIER();
+	out->head += length;
+	out->busy = 0;
+	out->bytes_written += length;
+	if(length) {
+		start_output(out);
+	}
+}
+
+uint16_t serial_output_write(SerialOutput* out, const void* data,
+		uint16_t length) {
+	const char* bytes = data;
+	uint16_t written = 0;
+	out->busy = 1;
+	while(written < length) {
+		/* Copy as much as we can, up to the end of the buffer */
+		uint8_t start = out->head & BUFFER_MASK;
+		uint16_t chunk = SERIAL_OUTPUT_SIZE - start;
+		if(chunk > length - written) {
+			chunk = length - written;
+		}
+		if(chunk > BUFFER_ROOM) {
+			chunk = BUFFER_ROOM;
+		}
+		if(out->policy == SERIAL_DROP_OLDEST) {
+			make_room(out, chunk);
+		} else if(!make_room(out, 1)) {
+			/* Blocking with interrupts disabled or dropping new
+			 * bytes - the rest (less the one counted) is lost too
+			 */
+			out->dropped[out->policy] += length - written - 1;
+			break;
+		} else if(chunk > room(out)) {
+			chunk = room(out);
+		}
+		memcpy(&out->buffer[start], bytes + written, chunk);
+		OUTPUT_BARRIER();
+		out->head += chunk;
+		written += chunk;
+		start_output(out);
+	}
+	out->busy = 0;
+	out->bytes_written += written;
+	return written;
+}
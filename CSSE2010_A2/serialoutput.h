@@ -0,0 +1,97 @@
+/*
+ * serialoutput.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Interrupt driven output buffer for a USART, shared by serial port 0
+ * (serialio.c) and serial port 1 (serial1.c) - each has a SerialOutput of
+ * its own, and its UDR empty interrupt handler sends from it with
+ * serial_output_next().
+ *
+ * The buffer is 256 bytes indexed by head and tail counts that count up
+ * forever (wrapping at 256), so the number of bytes waiting is simply
+ * head - tail and the position in the buffer is the low 8 bits - no wrap
+ * around tests are needed. Only the main program moves head and only the
+ * interrupt handler moves tail (except to drop the oldest output), and
+ * each is a single byte, so neither needs interrupts disabled. At most 255
+ * bytes can wait (256 would look the same as none).
+ * The extra bytes past the end let serial_output_reserve() hand out space
+ * that carries on past the end of the buffer - serial_output_commit()
+ * moves that part round to the start.
+ */
+
+#ifndef SERIALOUTPUT_H_
+#define SERIALOUTPUT_H_
+
+#include <stdint.h>
+
+#define SERIAL_OUTPUT_SIZE 256
+
+/* Most bytes that can be reserved at once */
+#define SERIAL_MAX_RESERVE 32
+
+/* What output does when the output buffer is full */
+typedef enum {
+	SERIAL_BLOCK,		/* wait for room (drops if interrupts are disabled) */
+	SERIAL_DROP_NEWEST,	/* drop the characters being written */
+	SERIAL_DROP_OLDEST,	/* overwrite the oldest characters waiting to go */
+	SERIAL_NUM_POLICIES
+} SerialOutputPolicy;
+
+typedef struct {
+	char buffer[SERIAL_OUTPUT_SIZE + SERIAL_MAX_RESERVE];
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	/* Set while the main program is part way through adding to the
+	 * buffer, so that interrupt handlers keep out of the way */
+	volatile uint8_t busy;
+	uint8_t policy;
+	uint32_t dropped[SERIAL_NUM_POLICIES];
+	uint32_t bytes_written;
+	/* The USART's UCSRnB register and its UDRIEn bit, to start sending */
+	volatile uint8_t* control;
+	uint8_t udr_empty_enable;
+} SerialOutput;
+
+/* Empty the buffer, with the given policy. control and udr_empty_enable
+ * are the USART's UCSRnB register and UDRIEn bit.
+ */
+void serial_output_init(SerialOutput* out, volatile uint8_t* control,
+		uint8_t udr_empty_enable, uint8_t policy);
+
+/* As serial_set_output_policy() and serial_dropped() (serialio.h) */
+uint8_t serial_output_set_policy(SerialOutput* out, uint8_t policy);
+uint32_t serial_output_dropped(const SerialOutput* out, uint8_t policy);
+
+/* Add one byte, making room according to the policy. Returns 0 if it was
+ * dropped.
+ */
+uint8_t serial_output_put(SerialOutput* out, char c);
+
+/* Add one byte from an interrupt handler, if there is room and the main
+ * program isn't part way through adding output. Returns 0 if it wasn't
+ * added (it isn't counted as dropped). Not counted in bytes_written.
+ */
+uint8_t serial_output_put_from_isr(SerialOutput* out, char c);
+
+/* As serial_reserve(), serial_commit() and serial_write() (serialio.h) */
+char* serial_output_reserve(SerialOutput* out, uint8_t n);
+void serial_output_commit(SerialOutput* out, uint8_t length);
+uint16_t serial_output_write(SerialOutput* out, const void* data,
+		uint16_t length);
+
+/* For the UDR empty interrupt handler: the next byte to send, or -1 if
+ * there are none (in which case the UDR empty interrupt has been turned
+ * off until more output is added).
+ */
+static inline int16_t serial_output_next(SerialOutput* out) {
+	uint8_t tail = out->tail;
+	if(tail == out->head) {
+		*out->control &= ~out->udr_empty_enable;
+		return -1;
+	}
+	out->tail = tail + 1;
+	return (uint8_t)out->buffer[tail];
+}
+
+#endif /* SERIALOUTPUT_H_ */
@@ -5,8 +5,25 @@
  */ 
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "spi.h"
 
+// Transmit queue. queue_head and queue_tail count up forever (wrapping at
+// 256) and are masked to index the buffer, so head - tail is always the
+// number of bytes waiting. Only the main program advances the head. The
+// tail is advanced by the interrupt handler, and by spi_queue_bytes() when
+// it starts a transfer - which it does with interrupts disabled, as the
+// handler could otherwise advance the tail at the same time. transmitting
+// is set while a byte is in flight - the transfer complete interrupt will
+// then send the next.
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+static volatile uint8_t queue[SPI_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+static volatile uint8_t transmitting;
+static uint8_t high_water;
+static uint16_t rejections;
+
 void spi_setup_master(uint8_t clockdivider) {
 	// Set up SPI communication as a master
 	// Make the SS, MOSI and SCK pins outputs. These are pins
@@ -20,7 +37,8 @@ void spi_setup_master(uint8_t clockdivider) {
 	// Set up the SPI control registers SPCR and SPSR:
 	// - SPE bit = 1 (SPI is enabled)
 	// - MSTR bit = 1 (Master Mode)
-	SPCR0 = (1<<SPE0)|(1<<MSTR0);
+	// - SPIE bit = 1 (Transfer complete interrupt drives the queue)
+	SPCR0 = (1<<SPE0)|(1<<MSTR0)|(1<<SPIE0);
 	
 	// Set SPR0 and SPR1 bits in SPCR and SPI2X bit in SPSR
 	// based on the given clock divider
@@ -39,7 +57,8 @@ void spi_setup_master(uint8_t clockdivider) {
 	switch(clockdivider) {
 		case 128:
 			SPCR0 |= (1<<SPR00);
-			// Note this flows through to the next code block
+			// Note this falls through to the next code block
+			/* fall through */
 		case 32:
 		case 64:
 			SPCR0 |= (1<<SPR10);
@@ -52,9 +71,22 @@ void spi_setup_master(uint8_t clockdivider) {
 	
 	// Take SS (slave select) line low
 	PORTB &= ~(1<<4);
+	
+	queue_head = 0;
+	queue_tail = 0;
+	transmitting = 0;
+	high_water = 0;
+	rejections = 0;
 }
 
 uint8_t spi_send_byte(uint8_t byte) {
+	// Let the queue drain, then turn off the transfer complete interrupt
+	// so that it doesn't clear the SPIF0 bit we are about to wait on.
+	while(transmitting) {
+		; // wait
+	}
+	SPCR0 &= ~(1<<SPIE0);
+	
 	// Write out the byte to the SPDR0 register. This will initiate
 	// the transfer. We then wait until the most significant byte of
 	// SPSR0 (SPIF0 bit) is set - this indicates that the transfer is
@@ -65,5 +97,65 @@ uint8_t spi_send_byte(uint8_t byte) {
 	while((SPSR0 & (1<<SPIF0)) == 0) {
 		; // wait
 	}
-	return SPDR0;
+	byte = SPDR0;
+	SPCR0 |= (1<<SPIE0);
+	return byte;
+}
+
+uint8_t spi_queue_bytes(const uint8_t* bytes, uint8_t length) {
+	// Copy the bytes in beyond the head before publishing the new head -
+	// the interrupt handler never looks past the head so this is safe
+	// with interrupts on.
+	uint8_t head = queue_head;
+	uint8_t waiting = head - queue_tail;
+	if(length > SPI_QUEUE_SIZE - waiting) {
+		rejections++;
+		return 0;
+	}
+	for(uint8_t i = 0; i < length; i++) {
+		queue[head++ & SPI_QUEUE_MASK] = bytes[i];
+	}
+	queue_head = head;
+	waiting += length;
+	if(waiting > high_water) {
+		high_water = waiting;
+	}
+	
+	// If nothing is in flight, send the first byte ourselves. The
+	// interrupt handler takes it from there.
+	uint8_t interrupts_were_enabled = bit_is_set(SREG, SREG_I);
+	cli();
+	if(!transmitting && queue_head != queue_tail) {
+		transmitting = 1;
+		SPDR0 = queue[queue_tail++ & SPI_QUEUE_MASK];
+	}
+	if(interrupts_were_enabled) {
+		sei();
+	}
+	return 1;
+}
+
+uint8_t spi_queue_space(void) {
+	return SPI_QUEUE_SIZE - (uint8_t)(queue_head - queue_tail);
+}
+
+uint8_t spi_queue_idle(void) {
+	return !transmitting;
+}
+
+uint8_t spi_queue_high_water(void) {
+	return high_water;
+}
+
+uint16_t spi_queue_rejections(void) {
+	return rejections;
+}
+
+// Transfer of the previous byte has finished - send the next one
+ISR(SPI_STC_vect) {
+	if(queue_head != queue_tail) {
+		SPDR0 = queue[queue_tail++ & SPI_QUEUE_MASK];
+	} else {
+		transmitting = 0;
+	}
 }
\ No newline at end of file
@@ -2,17 +2,41 @@
  * spi.h
  *
  * Author: Peter Sutton
- */ 
+ */
 
 #ifndef SPI_H_
 #define SPI_H_
 
+#include <stdint.h>
+
+// Size of the transmit queue. Must be a power of 2 no larger than 128.
+#define SPI_QUEUE_SIZE 64
+
 // Set up SPI communication as a master.
 // clockdivider should be one of 2,4,8,16,32,64,128
 void spi_setup_master(uint8_t clockdivider);
 
-// Send and receive an SPI byte. This function will take at least 8 
-// cyles of the divided clock (i.e. will busy wait).
+// Send and receive an SPI byte. This function will take at least 8
+// cyles of the divided clock (i.e. will busy wait). Any queued bytes
+// are sent first.
 uint8_t spi_send_byte(uint8_t byte);
 
-#endif /* SPI_H_ */
\ No newline at end of file
+// Add length bytes to the transmit queue. They are sent in the background
+// by the SPI transfer complete interrupt. Either all of the bytes are
+// queued (returns 1) or, if there is not enough space, none of them are
+// (returns 0). Never blocks.
+uint8_t spi_queue_bytes(const uint8_t* bytes, uint8_t length);
+
+// Number of bytes that can currently be added to the transmit queue
+uint8_t spi_queue_space(void);
+
+// Returns non-zero once every queued byte has been sent
+uint8_t spi_queue_idle(void);
+
+// Queue statistics - the largest number of bytes that have been waiting
+// in the queue at once, and the number of spi_queue_bytes() calls that
+// were refused for lack of space.
+uint8_t spi_queue_high_water(void);
+uint16_t spi_queue_rejections(void);
+
+#endif /* SPI_H_ */
@@ -0,0 +1,111 @@
+/*
+ * ssd.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Timer 0 counts freely (see timer0.c), 125 counts to a millisecond. The
+ * interrupt moves OCR0B on each time, alternately to the end of the lit
+ * time and to the start of the next turn, so the 8 bit compare value
+ * wrapping around doesn't matter.
+ * The main program also changes port C (the LEDs), so it must do so with
+ * interrupts disabled.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "ssd.h"
+
+// Timer 0 counts in a digit's turn, and at the start of it when nothing is lit
+#define TURN_COUNTS 125
+#define BLANK_COUNTS 4
+#define MAX_LIT_COUNTS (TURN_COUNTS - BLANK_COUNTS)
+
+// What each digit puts on the ports - segments and decimal point on port
+// A, and common cathode select on port C
+typedef struct {
+	uint8_t porta;
+	uint8_t portc;
+} DigitImage;
+
+#define PORTA_MASK (SEG_MASK|SSD_DP)
+
+static volatile DigitImage images[2];
+static volatile uint8_t lit_counts;
+static uint8_t brightness;
+
+// Interrupt state
+static uint8_t current_digit;
+static uint8_t lit;
+static uint8_t turn_start;	// OCR0B value the current turn started at
+
+void init_ssd(void) {
+	DDRA |= PORTA_MASK;
+	PORTA &= (uint8_t)~PORTA_MASK;
+	DDRC |= SSD_CC;
+
+	images[SSD_RIGHT].porta = 0;
+	images[SSD_RIGHT].portc = 0;
+	images[SSD_LEFT].porta = 0;
+	images[SSD_LEFT].portc = SSD_CC;
+	ssd_set_brightness(100);
+
+	current_digit = SSD_RIGHT;
+	lit = 0;
+	turn_start = TCNT0 + TURN_COUNTS;
+	OCR0B = turn_start + BLANK_COUNTS;
+	TIFR0 = (1<<OCF0B);
+	TIMSK0 |= (1<<OCIE0B);
+}
+
+void ssd_set_digit(uint8_t digit, uint8_t segments, uint8_t point) {
+	uint8_t porta = (segments & SEG_MASK) | (point ? SSD_DP : 0);
+	uint8_t portc = digit == SSD_LEFT ? SSD_CC : 0;
+
+	// Both bytes have to change together
+	uint8_t interruptsOn = bit_is_set(SREG, SREG_I);
+	cli();
+	images[digit & 1].porta = porta;
+	images[digit & 1].portc = portc;
+	if(interruptsOn) {
+		sei();
+	}
+}
+
+void ssd_set_brightness(uint8_t percent) {
+	if(percent > 100) {
+		percent = 100;
+	}
+	brightness = percent;
+	lit_counts = (uint16_t)MAX_LIT_COUNTS * percent / 100;
+}
+
+uint8_t ssd_brightness(void) {
+	return brightness;
+}
+
+ISR(TIMER0_COMPB_vect) {
+	if(lit) {
+		// End of the lit time - blank until the other digit's turn
+		PORTA &= (uint8_t)~PORTA_MASK;
+		lit = 0;
+		turn_start += TURN_COUNTS;
+		OCR0B = turn_start + BLANK_COUNTS;
+		return;
+	}
+
+	// End of the blank at the start of a turn. The segments have been off
+	// since the last digit's lit time ended, so the cathode can switch.
+	current_digit ^= 1;
+	const volatile DigitImage* image = &images[current_digit];
+	PORTC = (PORTC & ~SSD_CC) | image->portc;
+	uint8_t counts = lit_counts;
+	if(counts) {
+		PORTA = (PORTA & ~PORTA_MASK) | image->porta;
+		lit = 1;
+		OCR0B = turn_start + BLANK_COUNTS + counts;
+	} else {
+		turn_start += TURN_COUNTS;
+		OCR0B = turn_start + BLANK_COUNTS;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * ssd.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Two digit seven segment display, refreshed from the timer 0 compare match
+ * B interrupt so that it keeps going however busy the main program is.
+ * The digits take turns, 1ms each. Each turn starts with a short blank
+ * with the segments off while the common cathode switches over (so the
+ * last digit doesn't ghost onto the next), then the digit is lit for a
+ * share of what is left of the turn set by the brightness.
+ *
+ * Segments A to G are on port A pins 0 to 6, the decimal point on port A
+ * pin 7 and the common cathode select on port C pin 0 (low for the right
+ * digit). (Port D pins 2 and 3 are left for serial port 1.)
+ */
+
+#ifndef SSD_H_
+#define SSD_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define SEG_A (1<<PA0)
+#define SEG_B (1<<PA1)
+#define SEG_C (1<<PA2)
+#define SEG_D (1<<PA3)
+#define SEG_E (1<<PA4)
+#define SEG_F (1<<PA5)
+#define SEG_G (1<<PA6)
+#define SEG_MASK (SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G)
+
+#define SSD_DP (1<<PA7)
+#define SSD_CC (1<<PC0)
+
+#define SSD_RIGHT 0
+#define SSD_LEFT 1
+
+/* Set up the pins and start refreshing, with both digits blank and full
+ * brightness. Timer 0 must already be running (init_timer0()).
+ */
+void init_ssd(void);
+
+/* Segments (SEG_ bits) to show on a digit, and whether its decimal point
+ * is lit. Takes effect from the digit's next turn.
+ */
+void ssd_set_digit(uint8_t digit, uint8_t segments, uint8_t point);
+
+/* Brightness as a percentage (0 to 100) of the time each digit could be
+ * lit.
+ */
+void ssd_set_brightness(uint8_t percent);
+uint8_t ssd_brightness(void);
+
+#endif /* SSD_H_ */
@@ -0,0 +1,156 @@
+/*
+ * statusview.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "statusview.h"
+#include "serialio.h"
+#include "terminalio.h"
+
+// Moving the cursor costs around 8 characters, so gaps of unchanged
+// characters shorter than this are simply written out again
+#define MERGE_GAP 6
+
+// Longest cursor movement, "\x1b[255;255H"
+#define CURSOR_MOVE_LENGTH 10
+
+typedef struct {
+	uint8_t x;		// terminal column of the first character of the value
+	uint8_t y;		// terminal row
+	uint8_t length;	// number of characters of shown[] on the terminal
+	char shown[STATUSVIEW_FIELD_WIDTH];
+} Field;
+
+static Field fields[STATUSVIEW_MAX_FIELDS];
+static uint8_t num_fields;
+
+static uint32_t step_start_bytes;
+static uint16_t last_step_bytes;
+static uint16_t max_step_bytes;
+static uint32_t total_step_bytes;
+static uint32_t steps;
+
+void statusview_init(void) {
+	num_fields = 0;
+	step_start_bytes = serial_bytes_written();
+	last_step_bytes = 0;
+	max_step_bytes = 0;
+	total_step_bytes = 0;
+	steps = 0;
+}
+
+uint8_t statusview_add_field(uint8_t x, uint8_t y, const char* label) {
+	if(num_fields >= STATUSVIEW_MAX_FIELDS) {
+		return STATUSVIEW_NO_FIELD;
+	}
+	move_terminal_cursor(x, y);
+	printf_P(label);
+	Field* field = &fields[num_fields];
+	field->x = x + strlen_P(label);
+	field->y = y;
+	field->length = 0;
+	return num_fields++;
+}
+
+// Character the terminal shows at position i of a field
+static char shown_char(Field* field, uint8_t i) {
+	return i < field->length ? field->shown[i] : ' ';
+}
+
+void statusview_set_value(uint8_t field_number, const char* value) {
+	if(field_number >= num_fields) {
+		return;
+	}
+	Field* field = &fields[field_number];
+	uint8_t length = strnlen(value, STATUSVIEW_FIELD_WIDTH);
+	uint8_t end = length > field->length ? length : field->length;
+
+	// Characters past the end of the new value are blanked out
+	char wanted[STATUSVIEW_FIELD_WIDTH];
+	for(uint8_t i = 0; i < end; i++) {
+		wanted[i] = i < length ? value[i] : ' ';
+	}
+
+	uint8_t i = 0;
+	while(i < end) {
+		if(wanted[i] == shown_char(field, i)) {
+			i++;
+			continue;
+		}
+		// Find the end of this run of changes, carrying on over short
+		// gaps of unchanged characters
+		uint8_t run_end = i + 1;
+		for(uint8_t j = i + 1; j < end && j - run_end < MERGE_GAP; j++) {
+			if(wanted[j] != shown_char(field, j)) {
+				run_end = j + 1;
+			}
+		}
+		// The cursor movement and the run go straight into the serial
+		// output buffer together - room for just those, and the NUL
+		// snprintf_P() writes after the cursor movement
+		uint8_t run_length = run_end - i;
+		char* out = serial_reserve(CURSOR_MOVE_LENGTH + run_length + 1);
+		if(!out) {
+			// Dropped (the serial output buffer is full). The terminal
+			// has what was sent before this run, and this run and the
+			// rest are sent next time.
+			memcpy(field->shown, wanted, i);
+			if(i > field->length) {
+				field->length = i;
+			}
+			return;
+		}
+		uint8_t n = snprintf_P(out, CURSOR_MOVE_LENGTH + 1, PSTR("\x1b[%d;%dH"),
+				field->y, field->x + i);
+		memcpy(out + n, &wanted[i], run_length);
+		serial_commit(n + run_length);
+		i = run_end;
+	}
+
+	memcpy(field->shown, value, length);
+	field->length = length;
+}
+
+void statusview_printf_P(uint8_t field, const char* format, ...) {
+	if(field >= num_fields) {
+		return;
+	}
+	char value[STATUSVIEW_FIELD_WIDTH + 1];
+	va_list args;
+	va_start(args, format);
+	vsnprintf_P(value, sizeof(value), format, args);
+	va_end(args);
+	statusview_set_value(field, value);
+}
+
+void statusview_measure_step(void) {
+	uint32_t now = serial_bytes_written();
+	last_step_bytes = now - step_start_bytes;
+	step_start_bytes = now;
+	if(last_step_bytes > max_step_bytes) {
+		max_step_bytes = last_step_bytes;
+	}
+	total_step_bytes += last_step_bytes;
+	steps++;
+}
+
+uint16_t statusview_last_step_bytes(void) {
+	return last_step_bytes;
+}
+
+uint16_t statusview_max_step_bytes(void) {
+	return max_step_bytes;
+}
+
+uint16_t statusview_average_step_bytes(void) {
+	if(steps == 0) {
+		return 0;
+	}
+	return total_step_bytes / steps;
+}
@@ -0,0 +1,61 @@
+/*
+ * statusview.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Status screen on the serial terminal made up of fields - a label that is
+ * printed once and a value after it that changes. When a value is set only
+ * the characters that differ from what the terminal already shows are sent,
+ * using cursor addressing to skip over the rest. This keeps the amount of
+ * output per update small so that the serial output buffer doesn't fill up
+ * and hold up the main loop.
+ */
+
+#ifndef STATUSVIEW_H_
+#define STATUSVIEW_H_
+
+#include <stdint.h>
+
+#define STATUSVIEW_MAX_FIELDS 16
+#define STATUSVIEW_FIELD_WIDTH 12
+
+/* Returned by statusview_add_field() when there is no room for another
+ * field. Setting its value does nothing.
+ */
+#define STATUSVIEW_NO_FIELD 0xFF
+
+/* Forget all fields. The terminal is expected to be clear. */
+void statusview_init(void);
+
+/* Print label (a string in program memory) at column x, row y of the
+ * terminal and create a field for the value that follows it. Returns the
+ * field number to use with the functions below, or STATUSVIEW_NO_FIELD
+ * (and nothing is printed) if STATUSVIEW_MAX_FIELDS fields have already
+ * been added.
+ */
+uint8_t statusview_add_field(uint8_t x, uint8_t y, const char* label);
+
+/* Change the value shown in a field. Values longer than
+ * STATUSVIEW_FIELD_WIDTH characters are cut short. If the serial output
+ * policy drops some of the changes, they are sent by the next update.
+ */
+void statusview_set_value(uint8_t field, const char* value);
+
+/* As above, with the value formatted by printf (format is a string in
+ * program memory).
+ */
+void statusview_printf_P(uint8_t field, const char* format, ...);
+
+/* Call once per movement step after setting the fields. Records the number
+ * of characters written to the terminal since the previous call.
+ */
+void statusview_measure_step(void);
+
+/* Characters written to the terminal in the last step, the most in any
+ * step, and the average per step.
+ */
+uint16_t statusview_last_step_bytes(void);
+uint16_t statusview_max_step_bytes(void);
+uint16_t statusview_average_step_bytes(void);
+
+#endif /* STATUSVIEW_H_ */
@@ -0,0 +1,62 @@
+/*
+ * stepmonitor.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdint.h>
+
+#include "stepmonitor.h"
+#include "timer0.h"
+
+static StepStats stats;
+static uint32_t deadline_us;
+static uint32_t last_start_us;
+
+void step_monitor_init(uint16_t deadline) {
+	stats.steps = 0;
+	stats.misses = 0;
+	stats.actual_us = 0;
+	stats.intended_us = 0;
+	stats.max_lateness_us = 0;
+	for(uint8_t i = 0; i < STEP_JITTER_BUCKETS; i++) {
+		stats.histogram[i] = 0;
+	}
+	deadline_us = (uint32_t)deadline * 1000;
+}
+
+void step_monitor_record(uint32_t release, uint16_t period) {
+	// Both clocks wrap at 2^32us, so the microsecond clock and the release
+	// in microseconds can be compared directly
+	uint32_t start_us = get_current_time_us();
+	uint32_t lateness_us = start_us - release * 1000;
+	if((int32_t)lateness_us < 0) {
+		lateness_us = 0;
+	}
+
+	if(stats.steps) {
+		stats.actual_us += start_us - last_start_us;
+		stats.intended_us += (uint32_t)period * 1000;
+	}
+	last_start_us = start_us;
+	stats.steps++;
+
+	if(lateness_us > stats.max_lateness_us) {
+		stats.max_lateness_us = lateness_us;
+	}
+	if(lateness_us > deadline_us) {
+		stats.misses++;
+	}
+	uint8_t bucket = 0;
+	for(uint16_t limit = STEP_JITTER_US; lateness_us >= limit &&
+			bucket < STEP_JITTER_BUCKETS - 1; limit <<= 1) {
+		bucket++;
+	}
+	if(stats.histogram[bucket] != 0xFFFF) {
+		stats.histogram[bucket]++;
+	}
+}
+
+const StepStats* step_monitor_stats(void) {
+	return &stats;
+}
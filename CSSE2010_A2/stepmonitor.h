@@ -0,0 +1,50 @@
+/*
+ * stepmonitor.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Checks that the cars really step at the speed asked for. The step task
+ * is released on a fixed grid (see scheduler.h), so each step has a time
+ * it should have started; this records how late each one actually started
+ * (the jitter), and the time actually taken between steps against the
+ * period each was meant to take. A step that started more than the
+ * deadline late is a miss.
+ *
+ * If the steps keep up, the actual and intended totals stay within the
+ * jitter of each other however long it runs; skipped or late steps show
+ * up as the actual total pulling ahead.
+ */
+
+#ifndef STEPMONITOR_H_
+#define STEPMONITOR_H_
+
+#include <stdint.h>
+
+// Lateness histogram: bucket 0 counts steps less than STEP_JITTER_US late,
+// each bucket after that up to twice as late as the one before, and the
+// last anything later (4ms and over)
+#define STEP_JITTER_BUCKETS 8
+#define STEP_JITTER_US 64
+
+typedef struct {
+	uint32_t steps;
+	uint32_t misses;		// steps that started more than the deadline late
+	uint64_t actual_us;		// time between the first step and the last
+	uint64_t intended_us;	// the periods those steps were meant to take
+	uint32_t max_lateness_us;
+	uint16_t histogram[STEP_JITTER_BUCKETS];	// (stops at 0xFFFF)
+} StepStats;
+
+/* Start counting again. deadline is how late (ms) a step can start
+ * without being a miss.
+ */
+void step_monitor_init(uint16_t deadline);
+
+/* Record a step starting now. release is when it should have started (ms)
+ * and period how long after the step before that was meant to be (ms).
+ */
+void step_monitor_record(uint32_t release, uint16_t period);
+
+const StepStats* step_monitor_stats(void);
+
+#endif /* STEPMONITOR_H_ */
@@ -0,0 +1,199 @@
+/*
+ * telemetry.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdint.h>
+#include <util/crc16.h>
+
+#include "telemetry.h"
+#include "serial1.h"
+
+// Record and CRC, COBS encoded (one extra byte for up to 254), with the
+// zero bytes either side
+#define MAX_FRAME (TELEMETRY_MAX_RECORD + 2 + 1 + 2)
+
+#if MAX_FRAME > SERIAL_MAX_RESERVE
+#error "Telemetry frames don't fit in a serial1_reserve()"
+#endif
+
+static uint8_t enabled;
+static uint8_t sequence;
+static uint8_t need_sync;
+static uint32_t last_time;		// time of the last record sent
+static uint32_t last_sync;
+static uint32_t frames;
+static uint32_t dropped;
+
+// Record being put together
+static uint8_t record[TELEMETRY_MAX_RECORD + 2];
+static uint8_t record_length;
+
+void telemetry_init(void) {
+	enabled = 0;
+	sequence = 0;
+	frames = 0;
+	dropped = 0;
+}
+
+void telemetry_enable(uint8_t on) {
+	enabled = on;
+	need_sync = 1;
+}
+
+uint8_t telemetry_enabled(void) {
+	return enabled;
+}
+
+static void put_varint(uint32_t value) {
+	while(value >= 0x80) {
+		record[record_length++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	record[record_length++] = value;
+}
+
+static void start_record(TelemetryType type) {
+	record_length = 0;
+	record[record_length++] = type;
+	record[record_length++] = sequence++;
+}
+
+// Adds the CRC, encodes the record and sends it. What happens if the
+// serial output is backed up is up to the policy - event records are
+// dropped rather than holding up the program.
+static void send_record(uint8_t policy) {
+	uint16_t crc = 0xFFFF;
+	for(uint8_t i = 0; i < record_length; i++) {
+		crc = _crc_ccitt_update(crc, record[i]);
+	}
+	record[record_length++] = crc & 0xFF;
+	record[record_length++] = crc >> 8;
+	frames++;
+
+	policy = serial1_set_output_policy(policy);
+	char* out = serial1_reserve(MAX_FRAME);
+	serial1_set_output_policy(policy);
+	if(!out) {
+		dropped++;
+		need_sync = 1;
+		return;
+	}
+
+	// COBS - each zero is replaced by the distance to the next one (or
+	// to the end), and the first byte is the distance to the first
+	uint8_t length = 0;
+	out[length++] = 0;
+	uint8_t code_at = length++;
+	uint8_t code = 1;
+	for(uint8_t i = 0; i < record_length; i++) {
+		if(record[i] == 0) {
+			out[code_at] = code;
+			code_at = length++;
+			code = 1;
+		} else {
+			out[length++] = record[i];
+			code++;
+		}
+	}
+	out[code_at] = code;
+	out[length++] = 0;
+	serial1_commit(length);
+}
+
+// Starts a record of the given type at the given time, sending a sync
+// record first if one is due
+static void start_timed_record(TelemetryType type, uint32_t time) {
+	if(need_sync || (int32_t)(time - last_sync) >= TELEMETRY_SYNC_INTERVAL) {
+		// Cleared first - if this record is dropped it is set again
+		need_sync = 0;
+		last_sync = time;
+		last_time = time;
+		start_record(TELEMETRY_SYNC);
+		put_varint(time);
+		put_varint(dropped);
+		send_record(SERIAL_DROP_NEWEST);
+	}
+	int32_t difference = time - last_time;
+	last_time = time;
+	start_record(type);
+	// Zigzag - small differences either way stay small
+	put_varint(((uint32_t)difference << 1) ^ (uint32_t)(difference >> 31));
+}
+
+void telemetry_controller_event(const ControllerEvent* event) {
+	if(!enabled) {
+		return;
+	}
+	const Traveller* traveller = event->traveller;
+	switch(event->type) {
+		case EVENT_CAR_STEP:
+			start_timed_record(TELEMETRY_STEP, event->time);
+			put_varint(event->car);
+			put_varint(controller_car(event->car)->position);
+			break;
+		case EVENT_ARRIVAL:
+			start_timed_record(TELEMETRY_ARRIVAL, event->time);
+			put_varint(event->car);
+			put_varint(event->floor);
+			break;
+		case EVENT_HALL_CALL:
+			start_timed_record(TELEMETRY_HALL_CALL, event->time);
+			put_varint(event->car);
+			put_varint(traveller->origin);
+			put_varint(traveller->destination);
+			break;
+		case EVENT_PICKUP:
+			start_timed_record(TELEMETRY_PICKUP, event->time);
+			put_varint(event->car);
+			put_varint(event->floor);
+			put_varint(traveller->origin);
+			put_varint(traveller->destination);
+			put_varint(traveller->pickup_time - traveller->call_time);
+			break;
+		case EVENT_DROPOFF:
+			start_timed_record(TELEMETRY_DROPOFF, event->time);
+			put_varint(event->car);
+			put_varint(event->floor);
+			put_varint(traveller->origin);
+			put_varint(traveller->destination);
+			put_varint(event->time - traveller->call_time);
+			break;
+		default:
+			return;
+	}
+	send_record(SERIAL_DROP_NEWEST);
+}
+
+void telemetry_deadline_miss(uint8_t task, uint32_t release, uint32_t finish) {
+	if(!enabled) {
+		return;
+	}
+	start_timed_record(TELEMETRY_MISS, finish);
+	put_varint(task);
+	put_varint(finish - release);
+	send_record(SERIAL_DROP_NEWEST);
+}
+
+void telemetry_reply(const char* text, uint8_t length) {
+	while(length) {
+		uint8_t chunk = length < TELEMETRY_MAX_REPLY_TEXT ? length :
+				TELEMETRY_MAX_REPLY_TEXT;
+		start_record(TELEMETRY_REPLY);
+		for(uint8_t i = 0; i < chunk; i++) {
+			record[record_length++] = text[i];
+		}
+		send_record(SERIAL_BLOCK);
+		text += chunk;
+		length -= chunk;
+	}
+}
+
+uint32_t telemetry_frames(void) {
+	return frames;
+}
+
+uint32_t telemetry_dropped(void) {
+	return dropped;
+}
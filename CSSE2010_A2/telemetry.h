@@ -0,0 +1,79 @@
+/*
+ * telemetry.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Binary telemetry on serial port 1 (serial1.h) - a record of every
+ * controller event and deadline miss, in a fraction of the bytes the status
+ * screen takes. It is off to start with and turned on by a command (:M 1,
+ * see command.h). host/telemetry_decode turns the stream into CSV.
+ *
+ * Each record is sent as a frame: the record and a CRC-16 (CRC-CCITT as
+ * in <util/crc16.h>, started at 0xFFFF, low byte first), COBS encoded so
+ * that it contains no zero bytes, with a zero byte before and after it.
+ * While telemetry is on, replies to commands sent on the port are framed
+ * too (TELEMETRY_REPLY), so everything on the port is a good frame.
+ *
+ * A record is its type, a sequence number (one more than the last frame
+ * made, including frames dropped because the serial output buffer was
+ * full), and then its values as varints (7 bits per byte, least
+ * significant first, the top bit set on all but the last byte):
+ *	- the time (ms) as a zigzag encoded difference from the time of the
+ *	  record before (for TELEMETRY_SYNC, the time itself)
+ *	- the values listed below for the type.
+ * The exception is TELEMETRY_REPLY, which has no time and carries text
+ * rather than values: up to TELEMETRY_MAX_REPLY_TEXT bytes of a reply, so
+ * a long reply takes several records. Each reply ends with a newline.
+ * A TELEMETRY_SYNC record starts the stream, follows any dropped frame and
+ * is sent every TELEMETRY_SYNC_INTERVAL ms, so a decoder can pick up the
+ * time again after losing frames.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#include "controller.h"
+
+#define TELEMETRY_SYNC_INTERVAL 1000
+
+// Longest record (before the CRC and encoding): type, sequence number, a
+// 32 bit time and four 32 bit values
+#define TELEMETRY_MAX_RECORD (2 + 5 * 5)
+#define TELEMETRY_MAX_REPLY_TEXT (TELEMETRY_MAX_RECORD - 2)
+
+typedef enum {
+	TELEMETRY_SYNC,			// frames dropped so far
+	TELEMETRY_STEP,			// car, position (rows above the ground floor)
+	TELEMETRY_ARRIVAL,		// car, floor
+	TELEMETRY_HALL_CALL,	// car, origin, destination
+	TELEMETRY_PICKUP,		// car, floor, origin, destination, wait (ms)
+	TELEMETRY_DROPOFF,		// car, floor, origin, destination, journey (ms)
+	TELEMETRY_MISS,			// task, lateness (ms from release to finish)
+	TELEMETRY_REPLY,		// (text, not values - see above)
+	TELEMETRY_NUM_TYPES
+} TelemetryType;
+
+void telemetry_init(void);
+
+void telemetry_enable(uint8_t on);
+uint8_t telemetry_enabled(void);
+
+/* Send a record of a controller event or a deadline miss (if telemetry is
+ * on). telemetry_deadline_miss() is a MissHandler for the scheduler.
+ */
+void telemetry_controller_event(const ControllerEvent* event);
+void telemetry_deadline_miss(uint8_t task, uint32_t release, uint32_t finish);
+
+/* Send a reply to a command (ending in a newline) as TELEMETRY_REPLY
+ * records. Unlike the other records, this waits for room in the serial
+ * output buffer rather than dropping them.
+ */
+void telemetry_reply(const char* text, uint8_t length);
+
+/* Frames made and frames dropped since telemetry_init() */
+uint32_t telemetry_frames(void);
+uint32_t telemetry_dropped(void);
+
+#endif /* TELEMETRY_H_ */
@@ -2,78 +2,216 @@
  * timer0.c
  *
  * Author: Peter Sutton
+ * Modified by Lachlan Holliday
  *
- * We setup timer0 to generate an interrupt every 1ms
- * We update a global clock tick variable - whose value
- * can be retrieved using the get_clock_ticks() function.
+ * Timer 0 counts freely, dividing the clock by 64, so each
+ * count is 8 microseconds and 125 counts make a millisecond.
+ * It overflows every 256 counts (2.048ms) and the overflow
+ * interrupt adds that to our clock. The time between
+ * overflows is read from the counter itself, so nothing has
+ * to happen every millisecond.
+ * Compare match A is used to wake the CPU from idle sleep at
+ * the time asked for by idle_until(), if that comes before
+ * the next overflow (the overflow wakes it otherwise).
+ * Anything that has to happen at a steady rate (sampling
+ * inputs) can be run by the overflow interrupt as its tick
+ * handler.
  */
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 
 #include "timer0.h"
 
-/* Our internal clock tick count - incremented every 
- * millisecond. Will overflow every ~49 days. */
+#define COUNTS_PER_MS 125
+#define US_PER_COUNT 8
+
+/* Milliseconds up to the last overflow, plus the counts past
+ * that millisecond (0 to 124). Will overflow every ~49 days. */
 static volatile uint32_t clockTicks;
+static volatile uint8_t clockCounts;
+
+/* Overflows so far (wrapping). Also tells readers of the two
+ * values above that the interrupt changed them. */
+static volatile uint8_t overflowCount;
+
+/* Time spent asleep in idle_until(), and the share of the
+ * last measured interval that was */
+static volatile uint32_t idleUs;
+static uint32_t idleWindowStartUs;
+static uint32_t idleWindowStartIdleUs;
+static uint8_t idlePercent;
+
+/* Called by the overflow interrupt, if set */
+static TickHandler tickHandler;
 
-/* Set up timer 0 to generate an interrupt every 1ms. 
- * We will divide the clock by 64 and count up to 124.
- * We will therefore get an interrupt every 64 x 125
- * clock cycles, i.e. every 1 milliseconds with an 8MHz
- * clock. 
- * The counter will be reset to 0 when it reaches it's
- * output compare value.
+/* Set up timer 0 to count freely with the clock divided by 64,
+ * interrupting when it overflows.
  */
 void init_timer0(void) {
-	/* Reset clock tick count. L indicates a long (32 bit) 
-	 * constant. 
+	/* Reset clock tick count. L indicates a long (32 bit)
+	 * constant.
 	 */
 	clockTicks = 0L;
-	
+	clockCounts = 0;
+	overflowCount = 0;
+	idleUs = 0;
+	idleWindowStartUs = 0;
+	idleWindowStartIdleUs = 0;
+	idlePercent = 0;
+	tickHandler = 0;
+
 	/* Clear the timer */
 	TCNT0 = 0;
 
-	/* Set the output compare value to be 124 */
-	OCR0A = 124;
-	
-	/* Set the timer to clear on compare match (CTC mode)
-	 * and to divide the clock by 64. This starts the timer
-	 * running.
+	/* Normal mode (count up to 255 and wrap), divide the
+	 * clock by 64. This starts the timer running.
 	 */
-	TCCR0A = (1<<WGM01);
+	TCCR0A = 0;
 	TCCR0B = (1<<CS01)|(1<<CS00);
 
-	/* Enable an interrupt on output compare match. 
+	/* Make sure the interrupt flags are cleared by writing
+	 * 1s to them, then enable the overflow interrupt.
 	 * Note that interrupts have to be enabled globally
 	 * before the interrupts will fire.
 	 */
-	TIMSK0 |= (1<<OCIE0A);
-	
-	/* Make sure the interrupt flag is cleared by writing a 
-	 * 1 to it.
+	TIFR0 = (1<<TOV0)|(1<<OCF0A);
+	TIMSK0 = (1<<TOIE0);
+}
+
+/* Reads the clock as whole milliseconds and counts past the
+ * last of them. Doesn't disable interrupts: if the overflow
+ * interrupt runs while the values are being copied (it
+ * changes overflowCount), they are copied again.
+ */
+static uint32_t read_clock(uint16_t* counts) {
+	uint32_t ticks;
+	uint16_t total;
+	uint8_t count;
+	uint8_t overflows;
+	uint8_t pending;
+	do {
+		overflows = overflowCount;
+		ticks = clockTicks;
+		total = clockCounts;
+		count = TCNT0;
+		pending = bit_is_set(TIFR0, TOV0);
+	} while(overflows != overflowCount);
+	/* If the timer has overflowed but the interrupt hasn't run
+	 * (interrupts are disabled), add the overflow. A small
+	 * count means it overflowed before we read the count.
 	 */
-	TIFR0 &= (1<<OCF0A);
+	if(pending && count < 128) {
+		total += 256;
+	}
+	total += count;
+	while(total >= COUNTS_PER_MS) {
+		total -= COUNTS_PER_MS;
+		ticks++;
+	}
+	*counts = total;
+	return ticks;
 }
 
 uint32_t get_current_time(void) {
-	uint32_t returnValue;
+	uint16_t counts;
+	return read_clock(&counts);
+}
+
+uint32_t get_current_time_us(void) {
+	uint16_t counts;
+	uint32_t ticks = read_clock(&counts);
+	return ticks * 1000 + counts * US_PER_COUNT;
+}
+
+uint16_t get_fast_time(void) {
+	uint8_t overflows;
+	uint8_t count;
+	uint8_t pending;
+	do {
+		overflows = overflowCount;
+		count = TCNT0;
+		pending = bit_is_set(TIFR0, TOV0);
+	} while(overflows != overflowCount);
+	if(pending && count < 128) {
+		overflows++;
+	}
+	return ((uint16_t)overflows << 8) | count;
+}
+
+void idle_until(uint32_t time) {
+	uint32_t start = get_current_time_us();
+	uint16_t counts;
 
-	/* Disable interrupts so we can be sure that the interrupt
-	 * doesn't fire when we've copied just a couple of bytes
-	 * of the value. Interrupts are re-enabled if they were
-	 * enabled at the start.
-	 */
-	uint8_t interruptsOn = bit_is_set(SREG, SREG_I);
 	cli();
-	returnValue = clockTicks;
-	if(interruptsOn) {
-		sei();
+	uint32_t now = read_clock(&counts);
+	int32_t ms_left = time - now;
+	if(ms_left > 0) {
+		/* If the wake up time comes before the next overflow,
+		 * compare match A wakes us then. Otherwise the
+		 * overflow wakes us and the caller sleeps again.
+		 * (Too close to be worth it and we don't sleep.)
+		 */
+		uint32_t counts_left = (uint32_t)ms_left * COUNTS_PER_MS - counts;
+		if(counts_left > 2) {
+			if(counts_left < 256) {
+				OCR0A = TCNT0 + counts_left;
+				TIFR0 = (1<<OCF0A);
+				TIMSK0 |= (1<<OCIE0A);
+			}
+			/* Interrupts are enabled by the instruction before
+			 * the sleep, so one can't slip in between and leave
+			 * us asleep with nothing to wake us. Any interrupt
+			 * (serial, buttons, SPI, timers) ends the sleep.
+			 */
+			set_sleep_mode(SLEEP_MODE_IDLE);
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+	}
+	sei();
+	idleUs += get_current_time_us() - start;
+}
+
+void set_tick_handler(TickHandler handler) {
+	tickHandler = handler;
+}
+
+uint8_t get_idle_percent(void) {
+	uint32_t now = get_current_time_us();
+	uint32_t elapsed = now - idleWindowStartUs;
+	/* Measured over intervals of at least a second */
+	if(elapsed >= 1000000UL) {
+		uint32_t idle = idleUs - idleWindowStartIdleUs;
+		idlePercent = idle / (elapsed / 100);
+		if(idlePercent > 100) {
+			idlePercent = 100;
+		}
+		idleWindowStartUs = now;
+		idleWindowStartIdleUs = idleUs;
+	}
+	return idlePercent;
+}
+
+ISR(TIMER0_OVF_vect) {
+	/* Add 256 counts - 2 milliseconds and 6 counts */
+	uint8_t counts = clockCounts + 6;
+	clockTicks += 2;
+	if(counts >= COUNTS_PER_MS) {
+		counts -= COUNTS_PER_MS;
+		clockTicks++;
+	}
+	clockCounts = counts;
+	overflowCount++;
+	if(tickHandler) {
+		tickHandler();
 	}
-	return returnValue;
 }
 
 ISR(TIMER0_COMPA_vect) {
-	/* Increment our clock tick count */
-	clockTicks++;
+	/* Only here to wake the CPU - once is enough */
+	TIMSK0 &= ~(1<<OCIE0A);
 }
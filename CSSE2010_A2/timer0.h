@@ -2,17 +2,20 @@
  * timer0.h
  *
  * Author: Peter Sutton
+ * Modified by Lachlan Holliday
  *
- * We set up timer 0 to give us an interrupt
- * every millisecond. Tasks that have to occur
- * regularly (every millisecond or few) can be added 
- * to the interrupt handler (in timer0.c) or can
- * be added to the main event loop that checks the
- * clock tick value. This value (32 bits) can be 
- * obtained using the get_clock_ticks() function.
- * (Any tasks undertaken in the interrupt handler
- * should be kept short so that we don't run the 
- * risk of missing an interrupt in future.)
+ * We set up timer 0 as our time reference. It doesn't
+ * interrupt every millisecond - the time is made up of
+ * the overflows counted so far (one every 2.048ms) and
+ * the timer's count. The overflow interrupt still comes
+ * every 2.048ms, asleep or not: it keeps the clock and
+ * runs the tick handler, which inputs.c debounces the
+ * buttons and switches on. So a sleep in idle_until()
+ * lasts until the time asked for or the next overflow,
+ * whichever is first, and the caller sleeps again if
+ * nothing is due - the CPU wakes at least every 2.048ms.
+ * The time in milliseconds (32 bits) can be obtained
+ * using the get_current_time() function.
  */
 
 #ifndef TIMER0_H_
@@ -20,14 +23,59 @@
 
 #include <stdint.h>
 
-/* Set up our timer to give us an interrupt every millisecond
- * and update our time reference.
+/* Set up our timer and reset our time reference to 0.
  */
 void init_timer0(void);
 
 /* Return the current clock tick value - milliseconds since the timer was
- * initialised.
+ * initialised. Safe to call from interrupt handlers and with interrupts
+ * disabled, and doesn't disable them itself.
  */
 uint32_t get_current_time(void);
 
+/* Return the time in microseconds since the timer was initialised, to the
+ * nearest 8us (one count of the timer). Wraps around every ~71 minutes, so
+ * only differences between two readings are meaningful.
+ */
+uint32_t get_current_time_us(void);
+
+/* Cheap 16 bit timestamp for timing short intervals, in counts of the
+ * timer (8us). Wraps around every 524ms, so intervals must be shorter than
+ * that. For example:
+ *	uint16_t start = get_fast_time();
+ *	...
+ *	uint32_t us = FAST_TIME_US(fast_time_since(start));
+ */
+uint16_t get_fast_time(void);
+
+static inline uint16_t fast_time_since(uint16_t start) {
+	return get_fast_time() - start;
+}
+
+#define FAST_TIME_US(counts) ((uint32_t)(counts) * 8)
+
+/* Put the CPU into idle sleep until the given time (in milliseconds) or the
+ * next interrupt, whichever comes first, and return. Any interrupt (serial,
+ * SPI, timers - including the overflow every 2.048ms) wakes it, so callers
+ * should check whether they have anything to do and call again if not.
+ * Returns straight away if the time has already come.
+ * It can be called with interrupts disabled, so that the caller can check
+ * for work and work out the time without an interrupt handler making work
+ * in between (which would then wait for the sleep to end). It always
+ * returns with interrupts enabled.
+ */
+void idle_until(uint32_t time);
+
+/* Function called from the timer interrupt every 2.048ms (TICK_US). It
+ * runs with interrupts off, so must be short.
+ */
+#define TICK_US 2048
+typedef void (*TickHandler)(void);
+void set_tick_handler(TickHandler handler);
+
+/* Percentage of time spent asleep in idle_until() over the last second or
+ * so - the CPU time the program had to spare.
+ */
+uint8_t get_idle_percent(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,811 @@
+/*
+ * avr_host.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Peripheral emulator for running the firmware as a Linux process. A
+ * SIGALRM interval timer drives a virtual clock counted in CPU cycles of
+ * an 8MHz ATmega324A. On each alarm the clock moves forward one tick and
+ * timers 0 and 1, the SPI port and both USARTs are brought up to date,
+ * event by event in time order. When a peripheral raises an interrupt that
+ * is enabled, the firmware's handler runs straight away from the signal
+ * handler if the I bit of SREG is set, and is otherwise held pending until
+ * sei() sets it - the same as the CPU interrupting the main program.
+ *
+ * What is emulated:
+ * - Timers 0 and 1: counting in normal and CTC modes, compare match A and
+ *   B and overflow interrupts. TCNT is only updated at events. PWM modes
+ *   count as if in normal (or CTC with OCRnA top) mode. Timer 2 (which
+ *   only drives the buzzer pin) does not run.
+ * - SPI: writing SPDR with SPE set starts a transfer, and a byte time
+ *   later SPIF is set and (if SPIE is set) the transfer complete interrupt
+ *   raised. A write while a transfer is in progress sets WCOL and is
+ *   ignored. Writes are noticed when an interrupt handler returns, at
+ *   sei(), and otherwise at the next alarm (so a polled transfer with
+ *   interrupts off never finishes). Nothing drives MISO: SPDR reads back
+ *   the byte sent.
+ * - USARTs: the data register empty interrupt is raised once per
+ *   character time while UDRIE is set. If UDRIE is still set after the
+ *   handler returns, the handler wrote UDR and the character is output.
+ *   USART0 reads from standard input and writes to standard output.
+ *   USART1 reads from and writes to the files named by HOST_USART1_IN and
+ *   HOST_USART1_OUT (if set).
+ * - Pin changes: port A to D inputs read as set by HOST_PINB and HOST_PIND
+ *   and then changed at the times given in the HOST_PIN_SCRIPT file. A
+ *   change of a pin enabled in PCMSKn sets PCIFn and raises the pin change
+ *   interrupt if PCIEn is set.
+ *
+ * Settings (environment variables):
+ *   HOST_SPEEDUP     virtual milliseconds per real millisecond (default 1)
+ *   HOST_TICK_US     real microseconds between alarms (default 1000)
+ *   HOST_RUN_MS      stop after this many virtual milliseconds
+ *   HOST_PIND        value read from port D (switches), e.g. 0x10
+ *   HOST_PINB        value read from port B (buttons)
+ *   HOST_RX_GAP_MS   virtual milliseconds between characters read from
+ *                    standard input (for scripted input)
+ *   HOST_USART1_IN   file to read USART1 input from (HOST_RX_GAP_MS
+ *                    applies to it too)
+ *   HOST_USART1_OUT  file to write USART1 output to
+ *   HOST_PIN_SCRIPT  file of pin changes, one per line: the virtual time
+ *                    (ms), the port letter and the new value of its PIN
+ *                    register, e.g. "1500 B 0x01" to press button B0 at
+ *                    1.5s. Lines must be in time order; '#' starts a
+ *                    comment. Bounces are simply more changes.
+ * On exit a summary of virtual time and interrupt counts goes to stderr.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "avr_host.h"
+
+volatile uint8_t host_reg[0x100];
+volatile uint16_t host_spdr = HOST_SPDR_SEEN;
+
+/* Interrupt vectors in priority order (as in the ATmega324A vector table).
+ * Vectors the firmware doesn't define are weak and null.
+ */
+typedef enum {
+	VEC_PCINT0, VEC_PCINT1, VEC_PCINT2, VEC_PCINT3,
+	VEC_TIMER2_COMPA, VEC_TIMER2_COMPB, VEC_TIMER2_OVF,
+	VEC_TIMER1_COMPA, VEC_TIMER1_COMPB, VEC_TIMER1_OVF,
+	VEC_TIMER0_COMPA, VEC_TIMER0_COMPB, VEC_TIMER0_OVF,
+	VEC_SPI_STC,
+	VEC_USART0_RX, VEC_USART0_UDRE, VEC_USART0_TX,
+	VEC_USART1_RX, VEC_USART1_UDRE, VEC_USART1_TX,
+	NUM_VECTORS
+} Vector;
+
+#define WEAK_VECTOR(name) extern void host_isr_##name(void) __attribute__((weak));
+WEAK_VECTOR(PCINT0) WEAK_VECTOR(PCINT1) WEAK_VECTOR(PCINT2) WEAK_VECTOR(PCINT3)
+WEAK_VECTOR(TIMER2_COMPA) WEAK_VECTOR(TIMER2_COMPB) WEAK_VECTOR(TIMER2_OVF)
+WEAK_VECTOR(TIMER1_COMPA) WEAK_VECTOR(TIMER1_COMPB) WEAK_VECTOR(TIMER1_OVF)
+WEAK_VECTOR(TIMER0_COMPA) WEAK_VECTOR(TIMER0_COMPB) WEAK_VECTOR(TIMER0_OVF)
+WEAK_VECTOR(SPI_STC)
+WEAK_VECTOR(USART0_RX) WEAK_VECTOR(USART0_UDRE) WEAK_VECTOR(USART0_TX)
+WEAK_VECTOR(USART1_RX) WEAK_VECTOR(USART1_UDRE) WEAK_VECTOR(USART1_TX)
+
+typedef struct {
+	const char* name;
+	void (*handler)(void);
+	uint8_t flag_address;	// interrupt flag cleared when the handler runs
+	uint8_t flag_bit;
+} VectorInfo;
+
+#define VECTOR(name, address, bit) { #name, host_isr_##name, address, bit }
+static const VectorInfo vectors[NUM_VECTORS] = {
+	VECTOR(PCINT0, 0x3B, PCIF0), VECTOR(PCINT1, 0x3B, PCIF1),
+	VECTOR(PCINT2, 0x3B, PCIF2), VECTOR(PCINT3, 0x3B, PCIF3),
+	VECTOR(TIMER2_COMPA, 0x37, OCF2A), VECTOR(TIMER2_COMPB, 0x37, OCF2B),
+	VECTOR(TIMER2_OVF, 0x37, TOV2),
+	VECTOR(TIMER1_COMPA, 0x36, OCF1A), VECTOR(TIMER1_COMPB, 0x36, OCF1B),
+	VECTOR(TIMER1_OVF, 0x36, TOV1),
+	VECTOR(TIMER0_COMPA, 0x35, OCF0A), VECTOR(TIMER0_COMPB, 0x35, OCF0B),
+	VECTOR(TIMER0_OVF, 0x35, TOV0),
+	VECTOR(SPI_STC, 0x4D, SPIF0),
+	VECTOR(USART0_RX, 0, 0), VECTOR(USART0_UDRE, 0, 0), VECTOR(USART0_TX, 0, 0),
+	VECTOR(USART1_RX, 0, 0), VECTOR(USART1_UDRE, 0, 0), VECTOR(USART1_TX, 0, 0),
+};
+
+static volatile uint32_t pending;
+static volatile uint32_t ticks_owed;	// alarms that arrived with interrupts off
+static volatile uint8_t emulating;
+static volatile uint32_t isr_counts[NUM_VECTORS];
+static volatile uint32_t isr_total;
+static volatile uint64_t now_cycles;
+
+static uint64_t tick_cycles = HOST_F_CPU / 1000;
+static uint64_t run_cycles;
+static uint64_t rx_gap_cycles;
+static struct timespec start_real;
+
+/* Timers */
+
+typedef struct {
+	uint8_t tccra, tccrb, tcnt, ocra, ocrb, icr, timsk, tifr;
+	uint8_t wide;
+	Vector vec_a, vec_b, vec_ovf;
+	uint32_t phase;		// CPU cycles since the last timer count
+} Timer;
+
+static Timer timers[] = {
+	{ 0x44, 0x45, 0x46, 0x47, 0x48, 0, 0x6E, 0x35, 0,
+		VEC_TIMER0_COMPA, VEC_TIMER0_COMPB, VEC_TIMER0_OVF, 0 },
+	{ 0x80, 0x81, 0x84, 0x88, 0x8A, 0x86, 0x6F, 0x36, 1,
+		VEC_TIMER1_COMPA, VEC_TIMER1_COMPB, VEC_TIMER1_OVF, 0 },
+};
+#define NUM_TIMERS (sizeof(timers) / sizeof(timers[0]))
+
+/* USARTs */
+
+#define OUTPUT_BUFFER 4096
+
+typedef struct {
+	uint8_t ucsra, ucsrb, ubrr, udr;
+	Vector vec_rx, vec_udre;
+	int in_fd;
+	int out_fd;
+	uint64_t tx_busy;	// cycles until the transmitter is free
+	uint64_t rx_wait;	// cycles until the next character can arrive
+	uint8_t rx_byte;
+	uint32_t tx_count;
+	uint32_t rx_count;
+	uint16_t out_length;
+	char out[OUTPUT_BUFFER];
+} Usart;
+
+// The rest of each starts at 0
+static Usart usarts[] = {
+	{ .ucsra = 0xC0, .ucsrb = 0xC1, .ubrr = 0xC4, .udr = 0xC6,
+		.vec_rx = VEC_USART0_RX, .vec_udre = VEC_USART0_UDRE,
+		.in_fd = 0, .out_fd = 1 },
+	{ .ucsra = 0xC8, .ucsrb = 0xC9, .ubrr = 0xCC, .udr = 0xCE,
+		.vec_rx = VEC_USART1_RX, .vec_udre = VEC_USART1_UDRE,
+		.in_fd = -1, .out_fd = -1 },
+};
+#define NUM_USARTS (sizeof(usarts) / sizeof(usarts[0]))
+
+/* SPI */
+
+static uint8_t spi_busy;
+static uint64_t spi_wait;	// cycles until the transfer in progress ends
+
+static void spi_check_write(void);
+
+/* Pin changes */
+
+#define MAX_PIN_CHANGES 1024
+
+typedef struct {
+	uint64_t cycle;
+	uint8_t port;		// 0 to 3 for ports A to D
+	uint8_t value;
+} PinChange;
+
+static PinChange pin_changes[MAX_PIN_CHANGES];
+static unsigned num_pin_changes;
+static unsigned next_pin_change;
+
+static struct termios saved_termios;
+static int termios_saved;
+
+static uint16_t reg16(uint8_t address) {
+	return host_reg[address] | (host_reg[address + 1] << 8);
+}
+
+static void set_reg16(uint8_t address, uint16_t value) {
+	host_reg[address] = value;
+	host_reg[address + 1] = value >> 8;
+}
+
+static void flush_output(void) {
+	for (unsigned i = 0; i < NUM_USARTS; i++) {
+		Usart* usart = &usarts[i];
+		if (usart->out_length && usart->out_fd >= 0) {
+			ssize_t written = write(usart->out_fd, usart->out, usart->out_length);
+			(void)written;
+		}
+		usart->out_length = 0;
+	}
+}
+
+/* Interrupt delivery */
+
+static void run_vector(Vector v) {
+	const VectorInfo* info = &vectors[v];
+	uint8_t sreg = SREG;
+	SREG = sreg & ~_BV(SREG_I);
+	if (info->flag_address) {
+		host_reg[info->flag_address] &= ~_BV(info->flag_bit);
+	}
+	isr_counts[v]++;
+	isr_total++;
+
+	for (unsigned i = 0; i < NUM_USARTS; i++) {
+		Usart* usart = &usarts[i];
+		if (v == usart->vec_rx) {
+			host_reg[usart->udr] = usart->rx_byte;
+			host_reg[usart->ucsra] &= ~_BV(RXC0);
+		}
+	}
+
+	if (info->handler) {
+		info->handler();
+	}
+	spi_check_write();
+
+	for (unsigned i = 0; i < NUM_USARTS; i++) {
+		Usart* usart = &usarts[i];
+		if (v == usart->vec_udre && (host_reg[usart->ucsrb] & _BV(UDRIE0))) {
+			// The handler wrote a character rather than turning the
+			// interrupt off
+			if (usart->out_length == OUTPUT_BUFFER) {
+				flush_output();
+			}
+			usart->out[usart->out_length++] = host_reg[usart->udr];
+			usart->tx_count++;
+			uint16_t ubrr = reg16(usart->ubrr) & 0x0FFF;
+			uint8_t divisor = host_reg[usart->ucsra] & _BV(U2X0) ? 8 : 16;
+			usart->tx_busy = 10ULL * divisor * (ubrr + 1);
+		}
+	}
+	SREG = sreg;
+}
+
+// Run pending interrupts in priority order. Called with the I bit set.
+// The I bit is cleared while each handler runs, so an alarm arriving in
+// the middle only marks its interrupts as pending.
+static void deliver(void) {
+	while (pending) {
+		SREG &= ~_BV(SREG_I);
+		uint32_t waiting = pending;
+		if (waiting) {
+			Vector v = __builtin_ctz(waiting);
+			__atomic_fetch_and(&pending, ~(1UL << v), __ATOMIC_SEQ_CST);
+			run_vector(v);
+		}
+		SREG |= _BV(SREG_I);
+	}
+}
+
+static void request(Vector v) {
+	__atomic_fetch_or(&pending, 1UL << v, __ATOMIC_SEQ_CST);
+	if (SREG & _BV(SREG_I)) {
+		deliver();
+	}
+}
+
+static void run_owed_ticks(void);
+
+void host_sei(void) {
+	__asm__ __volatile__ ("" ::: "memory");
+	// Checked before the I bit is set, so the alarm can't check too
+	if (!(SREG & _BV(SREG_I))) {
+		spi_check_write();
+	}
+	SREG |= _BV(SREG_I);
+	if (pending) {
+		deliver();
+	}
+	if (ticks_owed) {
+		run_owed_ticks();
+	}
+	__asm__ __volatile__ ("" ::: "memory");
+}
+
+/* Timer emulation */
+
+static uint16_t timer_prescaler(Timer* timer) {
+	static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return prescalers[host_reg[timer->tccrb] & 0x07];
+}
+
+static uint16_t timer_read(Timer* timer, uint8_t address) {
+	return timer->wide ? reg16(address) : host_reg[address];
+}
+
+static uint16_t timer_top(Timer* timer) {
+	uint8_t wgm_low = host_reg[timer->tccra] & 0x03;
+	uint8_t wgm_high = (host_reg[timer->tccrb] >> 3) & 0x03;
+	if (timer->wide) {
+		uint8_t mode = wgm_low | (wgm_high << 2);
+		if (mode == 4 || mode == 9 || mode == 11 || mode == 15) {
+			return reg16(timer->ocra);
+		}
+		if (mode == 8 || mode == 10 || mode == 12 || mode == 14) {
+			return reg16(timer->icr);
+		}
+		return 0xFFFF;
+	}
+	uint8_t mode = wgm_low | ((wgm_high & 1) << 2);
+	if (mode == 2 || mode == 5 || mode == 7) {
+		return host_reg[timer->ocra];
+	}
+	return 0xFF;
+}
+
+// Timer counts from count until it next reaches value
+static uint32_t counts_until(uint16_t count, uint16_t value, uint16_t top) {
+	if (value > top) {
+		return UINT32_MAX;
+	}
+	uint32_t counts = value >= count ? (uint32_t)(value - count) :
+			(uint32_t)top + 1 - count + value;
+	return counts ? counts : (uint32_t)top + 1;
+}
+
+static uint64_t timer_next_event(Timer* timer) {
+	uint16_t prescaler = timer_prescaler(timer);
+	if (!prescaler) {
+		return UINT64_MAX;
+	}
+	uint16_t top = timer_top(timer);
+	uint16_t count = timer_read(timer, timer->tcnt);
+	if (count > top) {
+		// Written past the top - counts on to the maximum and wraps
+		top = timer->wide ? 0xFFFF : 0xFF;
+	}
+	uint32_t counts = counts_until(count, 0, top);
+	uint32_t to_a = counts_until(count, timer_read(timer, timer->ocra), top);
+	uint32_t to_b = counts_until(count, timer_read(timer, timer->ocrb), top);
+	if (to_a < counts) {
+		counts = to_a;
+	}
+	if (to_b < counts) {
+		counts = to_b;
+	}
+	return (uint64_t)counts * prescaler - timer->phase;
+}
+
+static void timer_advance(Timer* timer, uint64_t cycles) {
+	uint16_t prescaler = timer_prescaler(timer);
+	if (!prescaler) {
+		return;
+	}
+	uint64_t total = timer->phase + cycles;
+	uint32_t counts = total / prescaler;
+	timer->phase = total % prescaler;
+	if (!counts) {
+		return;
+	}
+	uint16_t top = timer_top(timer);
+	uint16_t max = timer->wide ? 0xFFFF : 0xFF;
+	uint16_t count = timer_read(timer, timer->tcnt);
+	if (count > top) {
+		top = max;
+	}
+	uint32_t next = count + counts;
+	uint8_t wrapped = 0;
+	if (next > top) {
+		next = (next - top - 1) % ((uint32_t)top + 1);
+		wrapped = 1;
+	}
+	if (timer->wide) {
+		set_reg16(timer->tcnt, next);
+	} else {
+		host_reg[timer->tcnt] = next;
+	}
+
+	uint8_t mask = host_reg[timer->timsk];
+	if (next == timer_read(timer, timer->ocra)) {
+		host_reg[timer->tifr] |= _BV(OCF0A);
+		if (mask & _BV(OCIE0A)) {
+			request(timer->vec_a);
+		}
+	}
+	if (next == timer_read(timer, timer->ocrb)) {
+		host_reg[timer->tifr] |= _BV(OCF0B);
+		if (mask & _BV(OCIE0B)) {
+			request(timer->vec_b);
+		}
+	}
+	if (wrapped && top == max) {
+		host_reg[timer->tifr] |= _BV(TOV0);
+		if (mask & _BV(TOIE0)) {
+			request(timer->vec_ovf);
+		}
+	}
+}
+
+/* USART emulation */
+
+static uint64_t usart_char_cycles(Usart* usart) {
+	uint16_t ubrr = reg16(usart->ubrr) & 0x0FFF;
+	uint8_t divisor = host_reg[usart->ucsra] & _BV(U2X0) ? 8 : 16;
+	return 10ULL * divisor * (ubrr + 1);
+}
+
+static uint8_t usart_tx_wanted(Usart* usart) {
+	uint8_t control = host_reg[usart->ucsrb];
+	return (control & _BV(TXEN0)) && (control & _BV(UDRIE0)) &&
+			!(pending & (1UL << usart->vec_udre));
+}
+
+static uint8_t usart_rx_wanted(Usart* usart) {
+	uint8_t control = host_reg[usart->ucsrb];
+	return usart->in_fd >= 0 && (control & _BV(RXEN0)) &&
+			(control & _BV(RXCIE0)) && !(pending & (1UL << usart->vec_rx));
+}
+
+static uint64_t usart_next_event(Usart* usart) {
+	uint64_t next = UINT64_MAX;
+	if (usart_tx_wanted(usart)) {
+		next = usart->tx_busy;
+	}
+	if (usart_rx_wanted(usart) && usart->rx_wait < next) {
+		next = usart->rx_wait;
+	}
+	return next;
+}
+
+static void usart_advance(Usart* usart, uint64_t cycles) {
+	usart->tx_busy = usart->tx_busy > cycles ? usart->tx_busy - cycles : 0;
+	usart->rx_wait = usart->rx_wait > cycles ? usart->rx_wait - cycles : 0;
+
+	if (usart_rx_wanted(usart) && usart->rx_wait == 0) {
+		usart->rx_wait = usart_char_cycles(usart);
+		uint8_t c;
+		ssize_t got = read(usart->in_fd, &c, 1);
+		if (got == 1) {
+			if (rx_gap_cycles > usart->rx_wait) {
+				usart->rx_wait = rx_gap_cycles;
+			}
+			usart->rx_byte = c;
+			usart->rx_count++;
+			host_reg[usart->ucsra] |= _BV(RXC0);
+			request(usart->vec_rx);
+		} else if (got == 0) {
+			usart->in_fd = -1;	// end of input
+		}
+	}
+	if (usart_tx_wanted(usart) && usart->tx_busy == 0) {
+		request(usart->vec_udre);
+	}
+}
+
+/* SPI emulation */
+
+static uint64_t spi_byte_cycles(void) {
+	static const uint8_t dividers[4] = { 4, 16, 64, 128 };
+	uint8_t divider = dividers[SPCR0 & (_BV(SPR00) | _BV(SPR10))];
+	if (SPSR0 & _BV(SPI2X0)) {
+		divider /= 2;
+	}
+	return 8 * divider;
+}
+
+// Start a transfer if SPDR has been written since the last check
+static void spi_check_write(void) {
+	uint16_t data = host_spdr;
+	if (data & HOST_SPDR_SEEN) {
+		return;
+	}
+	host_spdr = data | HOST_SPDR_SEEN;
+	if (!(SPCR0 & _BV(SPE0))) {
+		return;
+	}
+	if (spi_busy) {
+		SPSR0 |= _BV(WCOL0);
+		return;
+	}
+	SPSR0 &= ~(_BV(SPIF0) | _BV(WCOL0));
+	spi_busy = 1;
+	spi_wait = spi_byte_cycles();
+}
+
+static uint64_t spi_next_event(void) {
+	return spi_busy ? spi_wait : UINT64_MAX;
+}
+
+static void spi_advance(uint64_t cycles) {
+	if (!spi_busy) {
+		return;
+	}
+	spi_wait = spi_wait > cycles ? spi_wait - cycles : 0;
+	if (spi_wait == 0) {
+		spi_busy = 0;
+		SPSR0 |= _BV(SPIF0);
+		if (SPCR0 & _BV(SPIE0)) {
+			request(VEC_SPI_STC);
+		}
+	}
+}
+
+/* Pin change emulation */
+
+static const uint8_t pin_addresses[4] = { 0x20, 0x23, 0x26, 0x29 };
+static const uint8_t pin_masks[4] = { 0x6B, 0x6C, 0x6D, 0x73 };
+
+static uint64_t pins_next_event(void) {
+	if (next_pin_change == num_pin_changes) {
+		return UINT64_MAX;
+	}
+	uint64_t cycle = pin_changes[next_pin_change].cycle;
+	return cycle > now_cycles ? cycle - now_cycles : 0;
+}
+
+static void pins_advance(void) {
+	while (next_pin_change < num_pin_changes &&
+			pin_changes[next_pin_change].cycle <= now_cycles) {
+		const PinChange* change = &pin_changes[next_pin_change++];
+		uint8_t address = pin_addresses[change->port];
+		uint8_t changed = host_reg[address] ^ change->value;
+		host_reg[address] = change->value;
+		if (changed & host_reg[pin_masks[change->port]]) {
+			PCIFR |= _BV(change->port);
+			if (PCICR & _BV(change->port)) {
+				request(VEC_PCINT0 + change->port);
+			}
+		}
+	}
+}
+
+// Reads the changes into pin_changes[] (the file is read with read(), as
+// <stdio.h> here is the firmware's)
+static void load_pin_script(const char* name) {
+	static char text[MAX_PIN_CHANGES * 32];
+	int fd = open(name, O_RDONLY);
+	ssize_t length = fd >= 0 ? read(fd, text, sizeof(text) - 1) : -1;
+	if (length < 0) {
+		fprintf(stderr, "host: can't read %s\n", name);
+		exit(1);
+	}
+	close(fd);
+	text[length] = 0;
+
+	unsigned number = 0;
+	for (char* line = text; line; ) {
+		char* end = strchr(line, '\n');
+		if (end) {
+			*end++ = 0;
+		}
+		number++;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		char* p = line + strspn(line, " \t\r");
+		if (*p) {
+			unsigned long ms = strtoul(p, &p, 0);
+			p += strspn(p, " \t");
+			char port = *p ? *p++ : 0;
+			unsigned long value = strtoul(p, &p, 0);
+			p += strspn(p, " \t\r");
+			if (port < 'A' || port > 'D' || value > 0xFF || *p ||
+					num_pin_changes == MAX_PIN_CHANGES) {
+				fprintf(stderr, "host: %s:%u: bad pin change\n", name, number);
+				exit(1);
+			}
+			PinChange* change = &pin_changes[num_pin_changes++];
+			change->cycle = (uint64_t)ms * (HOST_F_CPU / 1000);
+			change->port = port - 'A';
+			change->value = value;
+		}
+		line = end;
+	}
+}
+
+/* Virtual clock */
+
+static void advance_all(uint64_t cycles) {
+	now_cycles += cycles;
+	pins_advance();
+	for (unsigned i = 0; i < NUM_TIMERS; i++) {
+		timer_advance(&timers[i], cycles);
+	}
+	spi_advance(cycles);
+	for (unsigned i = 0; i < NUM_USARTS; i++) {
+		usart_advance(&usarts[i], cycles);
+	}
+}
+
+// Move the virtual clock forward, stopping at each peripheral event on
+// the way so that handlers run at the right time and in the right order
+static void run_cycles_forward(uint64_t cycles) {
+	uint64_t end = now_cycles + cycles;
+	while (now_cycles < end) {
+		// Handlers see to their own writes; this catches the main program's
+		spi_check_write();
+		uint64_t step = end - now_cycles;
+		for (unsigned i = 0; i < NUM_TIMERS; i++) {
+			uint64_t next = timer_next_event(&timers[i]);
+			if (next < step) {
+				step = next;
+			}
+		}
+		uint64_t next = spi_next_event();
+		if (next < step) {
+			step = next;
+		}
+		next = pins_next_event();
+		if (next < step) {
+			step = next;
+		}
+		for (unsigned i = 0; i < NUM_USARTS; i++) {
+			next = usart_next_event(&usarts[i]);
+			if (next < step) {
+				step = next;
+			}
+		}
+		advance_all(step);
+	}
+}
+
+static void restore_terminal(void) {
+	if (termios_saved) {
+		tcsetattr(0, TCSANOW, &saved_termios);
+		termios_saved = 0;
+	}
+	int flags = fcntl(0, F_GETFL);
+	if (flags >= 0) {
+		fcntl(0, F_SETFL, flags & ~O_NONBLOCK);
+	}
+}
+
+static void finish(void) {
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+	setitimer(ITIMER_REAL, &off, 0);
+	flush_output();
+	restore_terminal();
+
+	struct timespec end_real;
+	clock_gettime(CLOCK_MONOTONIC, &end_real);
+	double real_ms = (end_real.tv_sec - start_real.tv_sec) * 1e3 +
+			(end_real.tv_nsec - start_real.tv_nsec) / 1e6;
+	fprintf(stderr, "\nhost: %.1f virtual ms in %.1f real ms\n",
+			now_cycles / (HOST_F_CPU / 1000.0), real_ms);
+	for (unsigned i = 0; i < NUM_USARTS; i++) {
+		fprintf(stderr, "host: usart%u %u bytes out, %u in\n", i,
+				usarts[i].tx_count, usarts[i].rx_count);
+	}
+	for (int v = 0; v < NUM_VECTORS; v++) {
+		if (isr_counts[v]) {
+			fprintf(stderr, "host: %-13s %u interrupts\n", vectors[v].name,
+					isr_counts[v]);
+		}
+	}
+}
+
+// Run the ticks owed to the virtual clock. Called with the I bit set,
+// either from the alarm handler or from sei() in the main program.
+static void run_owed_ticks(void) {
+	emulating = 1;
+	uint32_t ticks;
+	while ((ticks = __atomic_exchange_n(&ticks_owed, 0, __ATOMIC_SEQ_CST))) {
+		run_cycles_forward(ticks * tick_cycles);
+		if (pending) {
+			deliver();
+		}
+	}
+	flush_output();
+	emulating = 0;
+	if (run_cycles && now_cycles >= run_cycles) {
+		finish();
+		exit(0);
+	}
+}
+
+// If the alarm arrives while interrupts are off, the tick is left for
+// sei() to run. Otherwise several interrupts of the same kind due in one
+// tick would be merged into one pending interrupt.
+static void on_alarm(int signal) {
+	(void)signal;
+	int saved_errno = errno;
+	ticks_owed++;
+	if (!emulating && (SREG & _BV(SREG_I))) {
+		run_owed_ticks();
+	}
+	errno = saved_errno;
+}
+
+static void on_interrupt(int signal) {
+	(void)signal;
+	finish();
+	exit(1);
+}
+
+uint64_t host_time_us(void) {
+	return now_cycles / (HOST_F_CPU / 1000000);
+}
+
+// Counts ticks still owed, so that delays with interrupts off finish
+void host_delay_us(uint32_t us) {
+	uint64_t end = now_cycles + ticks_owed * tick_cycles +
+			(uint64_t)us * (HOST_F_CPU / 1000000);
+	while (now_cycles + ticks_owed * tick_cycles < end) {
+		;
+	}
+}
+
+void host_sleep(void) {
+	uint32_t before = isr_total;
+	while (isr_total == before) {
+		pause();
+	}
+}
+
+static unsigned long env_number(const char* name, unsigned long fallback) {
+	const char* value = getenv(name);
+	if (!value || !*value) {
+		return fallback;
+	}
+	return strtoul(value, 0, 0);
+}
+
+__attribute__((constructor))
+static void host_start(void) {
+	unsigned long speedup = env_number("HOST_SPEEDUP", 1);
+	unsigned long tick_us = env_number("HOST_TICK_US", 1000);
+	if (speedup < 1) {
+		speedup = 1;
+	}
+	if (tick_us < 10) {
+		tick_us = 10;
+	}
+	tick_cycles = (uint64_t)tick_us * speedup * (HOST_F_CPU / 1000000);
+	run_cycles = (uint64_t)env_number("HOST_RUN_MS", 0) * (HOST_F_CPU / 1000);
+	rx_gap_cycles = (uint64_t)env_number("HOST_RX_GAP_MS", 0) * (HOST_F_CPU / 1000);
+	PIND = env_number("HOST_PIND", 0);
+	PINB = env_number("HOST_PINB", 0);
+	const char* pin_script = getenv("HOST_PIN_SCRIPT");
+	if (pin_script && *pin_script) {
+		load_pin_script(pin_script);
+	}
+	UCSR0A = _BV(UDRE0);
+	UCSR1A = _BV(UDRE1);
+
+	const char* usart1_in = getenv("HOST_USART1_IN");
+	if (usart1_in && *usart1_in) {
+		usarts[1].in_fd = open(usart1_in, O_RDONLY);
+	}
+	const char* usart1_out = getenv("HOST_USART1_OUT");
+	if (usart1_out && *usart1_out) {
+		usarts[1].out_fd = open(usart1_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	// Characters typed go straight to the emulated USART
+	if (isatty(0) && tcgetattr(0, &saved_termios) == 0) {
+		struct termios raw = saved_termios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(0, TCSANOW, &raw);
+		termios_saved = 1;
+	}
+	int flags = fcntl(0, F_GETFL);
+	if (flags >= 0) {
+		fcntl(0, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_real);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_interrupt;
+	sigaction(SIGINT, &action, 0);
+	sigaction(SIGTERM, &action, 0);
+	action.sa_handler = on_alarm;
+	action.sa_flags = SA_RESTART;
+	sigaddset(&action.sa_mask, SIGINT);
+	sigaddset(&action.sa_mask, SIGTERM);
+	sigaction(SIGALRM, &action, 0);
+
+	struct itimerval interval;
+	interval.it_interval.tv_sec = tick_us / 1000000;
+	interval.it_interval.tv_usec = tick_us % 1000000;
+	interval.it_value = interval.it_interval;
+	setitimer(ITIMER_REAL, &interval, 0);
+}
@@ -0,0 +1,46 @@
+/*
+ * avr_host.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Interface between the register shim headers in include/ and the
+ * peripheral emulator in avr_host.c. The ATmega324A's I/O registers are
+ * bytes of host_reg[] at their data memory addresses, so the firmware's
+ * register accesses compile unchanged. A SIGALRM timer advances a virtual
+ * clock and runs the emulated timers, SPI and USART, calling the
+ * firmware's interrupt handlers from the signal handler the way the CPU
+ * would interrupt the main program.
+ */
+
+#ifndef AVR_HOST_H_
+#define AVR_HOST_H_
+
+#include <stdint.h>
+
+#define HOST_F_CPU 8000000UL
+
+extern volatile uint8_t host_reg[0x100];
+
+/* SPDR0. It is 16 bits wide so that the emulator can tell when it has been
+ * written: the firmware's writes (of 8 bit values) leave the high byte
+ * clear, and the emulator sets HOST_SPDR_SEEN once it has started the
+ * transfer. Reads give the low byte, the last byte sent.
+ */
+#define HOST_SPDR_SEEN 0x100
+extern volatile uint16_t host_spdr;
+
+/* Set the I bit of SREG and run any interrupts that became pending while it
+ * was clear.
+ */
+void host_sei(void);
+
+/* Virtual time since the program started, in microseconds */
+uint64_t host_time_us(void);
+
+/* Busy wait for the given number of virtual microseconds */
+void host_delay_us(uint32_t us);
+
+/* Wait until the next interrupt (emulates the SLEEP instruction) */
+void host_sleep(void);
+
+#endif /* AVR_HOST_H_ */
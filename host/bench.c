@@ -0,0 +1,101 @@
+/*
+ * bench.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Service quality benchmark. Simulates every traffic pattern under every
+ * dispatch policy with the same seed and prints one tab-separated line
+ * each, so the output of two builds can be compared with diff. Times are
+ * in seconds; efficiency is the share of floors the cars passed with
+ * someone in them (floors_with_traveller over all floors passed).
+ *
+ * Usage: bench [-d seconds] [-r calls_per_minute] [-s seed] [-m speed_ms]
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "controller.h"
+#include "simulation.h"
+
+static const char* const policy_names[NUM_POLICIES] = {
+	"look", "scan", "nearest"
+};
+
+static double average(const uint32_t* samples, uint32_t count) {
+	double total = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		total += samples[i];
+	}
+	return count ? total / count : 0;
+}
+
+int main(int argc, char** argv) {
+	SimConfig config;
+	sim_default_config(&config);
+	config.duration_s = 8 * 3600;
+	config.calls_per_minute = 6;
+	int option;
+	while ((option = getopt(argc, argv, "d:r:s:m:")) != -1) {
+		switch (option) {
+			case 'd': config.duration_s = atof(optarg); break;
+			case 'r': config.calls_per_minute = atof(optarg); break;
+			case 's': config.seed = strtoull(optarg, 0, 0); break;
+			case 'm': config.speed = strtoul(optarg, 0, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-d seconds] [-r calls_per_minute] "
+						"[-s seed] [-m speed_ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (config.calls_per_minute <= 0 || config.duration_s <= 0) {
+		return 2;
+	}
+
+	printf("# floors=%u cars=%u duration_s=%.0f calls_per_minute=%g "
+			"seed=%" PRIu64 " speed_ms=%u\n", NUM_FLOORS, NUM_CARS,
+			config.duration_s, config.calls_per_minute, config.seed,
+			config.speed);
+	printf("pattern\tpolicy\tcalls\trejected\tjourneys\tjourneys_per_hour\t"
+			"wait_avg\twait_p95\twait_p99\twait_max\t"
+			"journey_avg\tjourney_p95\tjourney_p99\tefficiency\n");
+
+	for (TrafficPattern pattern = 0; pattern < NUM_TRAFFIC_PATTERNS; pattern++) {
+		for (DispatchPolicy policy = 0; policy < NUM_POLICIES; policy++) {
+			config.pattern = pattern;
+			config.policy = policy;
+			SimResult result;
+			sim_run(&config, &result);
+
+			const ControllerStats* stats = controller_stats();
+			uint32_t floors_with = 0;
+			uint32_t floors_without = 0;
+			for (uint8_t c = 0; c < NUM_CARS; c++) {
+				floors_with += controller_car(c)->floors_with_traveller;
+				floors_without += controller_car(c)->floors_without_traveller;
+			}
+			double wait_avg = average(result.waits, result.num_waits);
+			double journey_avg = average(result.journeys, result.num_journeys);
+
+			printf("%s\t%s\t%" PRIu32 "\t%" PRIu32 "\t%" PRIu32 "\t%.1f\t"
+					"%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.4f\n",
+					traffic_pattern_name(pattern), policy_names[policy],
+					stats->calls, stats->rejected_calls, stats->journeys,
+					stats->journeys * 3600000.0 / result.end_time,
+					wait_avg / 1000,
+					sim_percentile(result.waits, result.num_waits, 95) / 1000.0,
+					sim_percentile(result.waits, result.num_waits, 99) / 1000.0,
+					sim_percentile(result.waits, result.num_waits, 100) / 1000.0,
+					journey_avg / 1000,
+					sim_percentile(result.journeys, result.num_journeys, 95) / 1000.0,
+					sim_percentile(result.journeys, result.num_journeys, 99) / 1000.0,
+					floors_with + floors_without ?
+					(double)floors_with / (floors_with + floors_without) : 0.0);
+			sim_free_result(&result);
+		}
+	}
+	return 0;
+}
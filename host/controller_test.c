@@ -0,0 +1,56 @@
+/*
+ * controller_test.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Checks what the controller's event handler sees. Each traveller must
+ * already be off the waiting list when their pickup is reported, so that
+ * a handler redrawing the floor (as the firmware's does) no longer finds
+ * them there. Exits 1 with a message if not.
+ *
+ * Usage: controller_test
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "controller.h"
+
+// Travellers called, one per floor above the ground floor, going down
+#define CALLS (NUM_FLOORS - 1)
+
+static uint8_t pickups;
+static uint8_t failed;
+
+static void handle_controller_event(const ControllerEvent* event) {
+	if (event->type != EVENT_PICKUP) {
+		return;
+	}
+	pickups++;
+	if (controller_num_waiting() != CALLS - pickups ||
+			controller_waiting_destination(event->floor) != NO_FLOOR) {
+		fprintf(stderr, "pickup at floor %u: %u still waiting, floor shows "
+				"destination %u\n", event->floor, controller_num_waiting(),
+				controller_waiting_destination(event->floor));
+		failed = 1;
+	}
+}
+
+int main(void) {
+	controller_init(0);
+	controller_set_event_handler(handle_controller_event);
+	for (uint8_t floor = 1; floor <= CALLS; floor++) {
+		if (!controller_hall_call(floor, 0, 0)) {
+			fprintf(stderr, "call from floor %u refused\n", floor);
+			return 1;
+		}
+	}
+	for (uint32_t now = 1; pickups < CALLS && now < 100000; now++) {
+		controller_step(now);
+	}
+	if (pickups != CALLS) {
+		fprintf(stderr, "%u of %u travellers picked up\n", pickups, CALLS);
+		failed = 1;
+	}
+	return failed;
+}
@@ -0,0 +1,95 @@
+/*
+ * des.c
+ *
+ * Author: Lachlan Holliday
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "des.h"
+
+void des_init(DesQueue* queue) {
+	queue->events = 0;
+	queue->length = 0;
+	queue->capacity = 0;
+	queue->next_sequence = 0;
+	queue->now = 0;
+	queue->processed = 0;
+}
+
+void des_free(DesQueue* queue) {
+	free(queue->events);
+	des_init(queue);
+}
+
+static int earlier(const DesEvent* a, const DesEvent* b) {
+	if (a->time != b->time) {
+		return a->time < b->time;
+	}
+	if (a->priority != b->priority) {
+		return a->priority < b->priority;
+	}
+	return a->sequence < b->sequence;
+}
+
+void des_schedule(DesQueue* queue, uint64_t time, uint8_t priority,
+		uint8_t type, uint32_t data) {
+	if (queue->length == queue->capacity) {
+		queue->capacity = queue->capacity ? queue->capacity * 2 : 64;
+		queue->events = realloc(queue->events,
+				queue->capacity * sizeof(DesEvent));
+		if (!queue->events) {
+			fprintf(stderr, "des: out of memory\n");
+			exit(1);
+		}
+	}
+	if (time < queue->now) {
+		time = queue->now;
+	}
+	DesEvent event = { time, priority, type, data, queue->next_sequence++ };
+
+	// Move the new event up from the bottom of the heap
+	uint32_t i = queue->length++;
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (!earlier(&event, &queue->events[parent])) {
+			break;
+		}
+		queue->events[i] = queue->events[parent];
+		i = parent;
+	}
+	queue->events[i] = event;
+}
+
+int des_next(DesQueue* queue, DesEvent* event) {
+	if (queue->length == 0) {
+		return 0;
+	}
+	*event = queue->events[0];
+	queue->now = event->time;
+	queue->processed++;
+
+	// Move the last event down from the top of the heap
+	DesEvent last = queue->events[--queue->length];
+	uint32_t i = 0;
+	for (;;) {
+		uint32_t child = 2 * i + 1;
+		if (child >= queue->length) {
+			break;
+		}
+		if (child + 1 < queue->length &&
+				earlier(&queue->events[child + 1], &queue->events[child])) {
+			child++;
+		}
+		if (!earlier(&queue->events[child], &last)) {
+			break;
+		}
+		queue->events[i] = queue->events[child];
+		i = child;
+	}
+	if (queue->length) {
+		queue->events[i] = last;
+	}
+	return 1;
+}
@@ -0,0 +1,46 @@
+/*
+ * des.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Event queue for discrete-event simulation. Events are kept in a binary
+ * heap ordered by time, then by priority (lower first) and then by the
+ * order they were scheduled, so events due at the same time come out in
+ * a fixed order.
+ */
+
+#ifndef DES_H_
+#define DES_H_
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t time;		// milliseconds of simulated time
+	uint8_t priority;
+	uint8_t type;
+	uint32_t data;
+	uint64_t sequence;
+} DesEvent;
+
+typedef struct {
+	DesEvent* events;
+	uint32_t length;
+	uint32_t capacity;
+	uint64_t next_sequence;
+	uint64_t now;		// time of the last event taken off the queue
+	uint64_t processed;
+} DesQueue;
+
+void des_init(DesQueue* queue);
+void des_free(DesQueue* queue);
+
+/* Add an event. Events can't be scheduled before the current time. */
+void des_schedule(DesQueue* queue, uint64_t time, uint8_t priority,
+		uint8_t type, uint32_t data);
+
+/* Take the next event off the queue and move the current time to it.
+ * Returns 0 if the queue is empty.
+ */
+int des_next(DesQueue* queue, DesEvent* event);
+
+#endif /* DES_H_ */
@@ -0,0 +1,142 @@
+/*
+ * host_stdio.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * avr-libc style stream functions for the host build (see
+ * include/stdio.h). Output is formatted into a buffer by the host's
+ * vsnprintf and then passed one character at a time to the stream's put
+ * function, as avr-libc does.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+
+FILE* host_stdin;
+FILE* host_stdout;
+
+// Copy format to converted, replacing avr-libc's %S (string in program
+// memory) with %s. Conversion specifications are copied up to their
+// conversion character so that %%S is left alone.
+static const char* convert_format(const char* format, char* converted,
+		size_t size) {
+	if (!strchr(format, 'S')) {
+		return format;
+	}
+	size_t length = strlen(format);
+	if (length >= size) {
+		return format;
+	}
+	memcpy(converted, format, length + 1);
+	for (char* p = converted; *p; p++) {
+		if (*p != '%') {
+			continue;
+		}
+		p++;
+		while (*p && strchr("-+ #0123456789.*hlLjzt", *p)) {
+			p++;
+		}
+		if (*p == 'S') {
+			*p = 's';
+		} else if (!*p) {
+			break;
+		}
+	}
+	return converted;
+}
+
+int host_vfprintf(FILE* stream, const char* format, va_list args) {
+	char converted[256];
+	char buffer[256];
+	char* output = buffer;
+	format = convert_format(format, converted, sizeof(converted));
+
+	va_list copy;
+	va_copy(copy, args);
+	int length = vsnprintf(buffer, sizeof(buffer), format, copy);
+	va_end(copy);
+	if (length < 0) {
+		return length;
+	}
+	if ((size_t)length >= sizeof(buffer)) {
+		output = malloc(length + 1);
+		if (!output) {
+			return -1;
+		}
+		vsnprintf(output, length + 1, format, args);
+	}
+	for (int i = 0; i < length; i++) {
+		host_fputc(output[i], stream);
+	}
+	if (output != buffer) {
+		free(output);
+	}
+	return length;
+}
+
+int host_printf(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int length = host_vfprintf(host_stdout, format, args);
+	va_end(args);
+	return length;
+}
+
+int printf_P(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int length = host_vfprintf(host_stdout, format, args);
+	va_end(args);
+	return length;
+}
+
+int vsnprintf_P(char* buffer, size_t size, const char* format, va_list args) {
+	char converted[256];
+	return vsnprintf(buffer, size,
+			convert_format(format, converted, sizeof(converted)), args);
+}
+
+int snprintf_P(char* buffer, size_t size, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf_P(buffer, size, format, args);
+	va_end(args);
+	return length;
+}
+
+int host_fputc(int c, FILE* stream) {
+	if (!stream || !stream->put || stream->put((char)c, stream)) {
+		return EOF;
+	}
+	return (unsigned char)c;
+}
+
+int host_fputs(const char* s, FILE* stream) {
+	while (*s) {
+		if (host_fputc(*s++, stream) == EOF) {
+			return EOF;
+		}
+	}
+	return 0;
+}
+
+int host_puts(const char* s) {
+	if (host_fputs(s, host_stdout) == EOF) {
+		return EOF;
+	}
+	return host_fputc('\n', host_stdout) == EOF ? EOF : 0;
+}
+
+int host_fgetc(FILE* stream) {
+	if (!stream || !stream->get) {
+		return EOF;
+	}
+	int c = stream->get(stream);
+	if (c < 0) {
+		return EOF;
+	}
+	return (unsigned char)c;
+}
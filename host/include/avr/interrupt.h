@@ -0,0 +1,52 @@
+/*
+ * avr/interrupt.h (host build)
+ *
+ * Author: Lachlan Holliday
+ *
+ * Interrupt vectors become ordinary functions named host_isr_<vector>,
+ * which the peripheral emulator calls from its signal handler. cli() and
+ * sei() only change the I bit of the emulated SREG - the emulator holds
+ * back interrupts while it is clear.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define PCINT0_vect host_isr_PCINT0
+#define PCINT1_vect host_isr_PCINT1
+#define PCINT2_vect host_isr_PCINT2
+#define PCINT3_vect host_isr_PCINT3
+#define TIMER2_COMPA_vect host_isr_TIMER2_COMPA
+#define TIMER2_COMPB_vect host_isr_TIMER2_COMPB
+#define TIMER2_OVF_vect host_isr_TIMER2_OVF
+#define TIMER1_COMPA_vect host_isr_TIMER1_COMPA
+#define TIMER1_COMPB_vect host_isr_TIMER1_COMPB
+#define TIMER1_OVF_vect host_isr_TIMER1_OVF
+#define TIMER0_COMPA_vect host_isr_TIMER0_COMPA
+#define TIMER0_COMPB_vect host_isr_TIMER0_COMPB
+#define TIMER0_OVF_vect host_isr_TIMER0_OVF
+#define SPI_STC_vect host_isr_SPI_STC
+#define USART0_RX_vect host_isr_USART0_RX
+#define USART0_UDRE_vect host_isr_USART0_UDRE
+#define USART0_TX_vect host_isr_USART0_TX
+#define USART1_RX_vect host_isr_USART1_RX
+#define USART1_UDRE_vect host_isr_USART1_UDRE
+#define USART1_TX_vect host_isr_USART1_TX
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector) ISR(vector) { }
+
+#define cli() do { \
+	__asm__ __volatile__ ("" ::: "memory"); \
+	SREG &= ~_BV(SREG_I); \
+	__asm__ __volatile__ ("" ::: "memory"); \
+} while (0)
+#define sei() host_sei()
+#define reti() return
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,38 @@
+/*
+ * avr/pgmspace.h (host build)
+ *
+ * Author: Lachlan Holliday
+ *
+ * The host has one address space, so program memory data is ordinary
+ * const data. The _P formatting functions treat %S as a string the same
+ * way avr-libc does (on the host %S would mean a wide string).
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_ptr(address) (*(void* const*)(address))
+
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+
+int printf_P(const char* format, ...);
+int snprintf_P(char* buffer, size_t size, const char* format, ...);
+int vsnprintf_P(char* buffer, size_t size, const char* format, va_list args);
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
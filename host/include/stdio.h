@@ -0,0 +1,65 @@
+/*
+ * stdio.h (host build)
+ *
+ * Author: Lachlan Holliday
+ *
+ * avr-libc style streams on top of the host's stdio. A stream is a pair of
+ * put and get functions set up with FDEV_SETUP_STREAM, and stdin and stdout
+ * can be pointed at any stream, so serialio.c works unchanged. The
+ * formatting itself is done by the host's vsnprintf.
+ */
+
+#ifndef HOST_STDIO_H_
+#define HOST_STDIO_H_
+
+#include_next <stdio.h>
+#include <stdint.h>
+
+struct host_file {
+	int (*put)(char, struct host_file*);
+	int (*get)(struct host_file*);
+	uint8_t flags;
+	void* udata;
+};
+
+#define _FDEV_SETUP_READ 1
+#define _FDEV_SETUP_WRITE 2
+#define _FDEV_SETUP_RW (_FDEV_SETUP_READ | _FDEV_SETUP_WRITE)
+#define _FDEV_EOF (-2)
+#define _FDEV_ERR (-1)
+#define FDEV_SETUP_STREAM(put, get, rwflag) { put, get, rwflag, 0 }
+#define fdev_setup_stream(stream, p, g, f) \
+	do { (stream)->put = p; (stream)->get = g; (stream)->flags = f; (stream)->udata = 0; } while (0)
+#define fdev_set_udata(stream, u) do { (stream)->udata = u; } while (0)
+#define fdev_get_udata(stream) ((stream)->udata)
+
+extern struct host_file* host_stdin;
+extern struct host_file* host_stdout;
+int host_printf(const char* format, ...);
+int host_vfprintf(struct host_file* stream, const char* format, va_list args);
+int host_fputc(int c, struct host_file* stream);
+int host_fputs(const char* s, struct host_file* stream);
+int host_puts(const char* s);
+int host_fgetc(struct host_file* stream);
+
+#define FILE struct host_file
+#undef stdin
+#undef stdout
+#define stdin host_stdin
+#define stdout host_stdout
+#undef putchar
+#undef putc
+#undef getchar
+#undef getc
+#define printf host_printf
+#define vfprintf host_vfprintf
+#define fputc host_fputc
+#define putc host_fputc
+#define putchar(c) host_fputc(c, host_stdout)
+#define fputs host_fputs
+#define puts host_puts
+#define fgetc host_fgetc
+#define getc host_fgetc
+#define getchar() host_fgetc(host_stdin)
+
+#endif /* HOST_STDIO_H_ */
@@ -0,0 +1,22 @@
+/*
+ * util/crc16.h (host build)
+ *
+ * Author: Lachlan Holliday
+ *
+ * The C equivalent given in the avr-libc documentation for its CRC-CCITT
+ * update (polynomial 0x1021 bit reversed, usually started at 0xFFFF).
+ */
+
+#ifndef HOST_UTIL_CRC16_H_
+#define HOST_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	data ^= crc & 0xFF;
+	data ^= data << 4;
+	return (((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+			^ ((uint16_t)data << 3);
+}
+
+#endif /* HOST_UTIL_CRC16_H_ */
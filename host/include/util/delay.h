@@ -0,0 +1,17 @@
+/*
+ * util/delay.h (host build)
+ *
+ * Author: Lachlan Holliday
+ *
+ * Delays wait on the emulator's virtual clock.
+ */
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+#include "avr_host.h"
+
+#define _delay_us(us) host_delay_us(us)
+#define _delay_ms(ms) host_delay_us((uint32_t)(ms) * 1000)
+
+#endif /* HOST_UTIL_DELAY_H_ */
@@ -0,0 +1,162 @@
+/*
+ * sim.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Runs one simulation (see simulation.c) and prints a summary.
+ *
+ * Usage: sim [-d seconds] [-r calls_per_minute] [-s seed] [-g pattern]
+ *            [-c calls_file] [-p look|scan|nearest] [-m speed_ms] [-t]
+ * -g picks the traffic pattern (see traffic.h), -t prints each controller
+ * event as it happens. -c gives the travellers instead: one per line, the
+ * time (ms), origin and destination, in time order ('#' starts a comment).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "controller.h"
+#include "simulation.h"
+
+#define MAX_CALLS 4096
+
+static const char* const policy_names[NUM_POLICIES] = {
+	"look", "scan", "nearest"
+};
+
+static void usage(const char* program) {
+	fprintf(stderr, "usage: %s [-d seconds] [-r calls_per_minute] [-s seed] "
+			"[-g pattern] [-c calls_file] [-p look|scan|nearest] "
+			"[-m speed_ms] [-t]\n"
+			"patterns:", program);
+	for (TrafficPattern pattern = 0; pattern < NUM_TRAFFIC_PATTERNS; pattern++) {
+		fprintf(stderr, " %s", traffic_pattern_name(pattern));
+	}
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+// Reads the calls for -c
+static uint32_t read_calls(const char* name, SimCall* calls) {
+	FILE* file = fopen(name, "r");
+	if (!file) {
+		perror(name);
+		exit(1);
+	}
+	char line[128];
+	uint32_t count = 0;
+	unsigned number = 0;
+	while (fgets(line, sizeof(line), file)) {
+		number++;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		unsigned long long time;
+		unsigned origin, destination;
+		int fields = sscanf(line, "%llu %u %u", &time, &origin, &destination);
+		if (fields <= 0) {
+			continue;	// blank
+		}
+		if (fields != 3 || count == MAX_CALLS ||
+				(count && time < calls[count - 1].time)) {
+			fprintf(stderr, "%s:%u: bad call\n", name, number);
+			exit(1);
+		}
+		calls[count].time = time;
+		calls[count].origin = origin;
+		calls[count].destination = destination;
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+int main(int argc, char** argv) {
+	static SimCall calls[MAX_CALLS];
+	SimConfig config;
+	sim_default_config(&config);
+	int option;
+	while ((option = getopt(argc, argv, "d:r:s:g:c:p:m:t")) != -1) {
+		switch (option) {
+			case 'd': config.duration_s = atof(optarg); break;
+			case 'r': config.calls_per_minute = atof(optarg); break;
+			case 's': config.seed = strtoull(optarg, 0, 0); break;
+			case 'm': config.speed = strtoul(optarg, 0, 0); break;
+			case 't': config.trace = 1; break;
+			case 'c':
+				config.calls = calls;
+				config.num_calls = read_calls(optarg, calls);
+				break;
+			case 'g':
+				config.pattern = traffic_pattern_named(optarg);
+				if (config.pattern == NUM_TRAFFIC_PATTERNS) {
+					usage(argv[0]);
+				}
+				break;
+			case 'p':
+				for (config.policy = 0; config.policy < NUM_POLICIES;
+						config.policy++) {
+					if (!strcmp(optarg, policy_names[config.policy])) {
+						break;
+					}
+				}
+				if (config.policy == NUM_POLICIES) {
+					usage(argv[0]);
+				}
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (config.calls_per_minute <= 0 || config.duration_s <= 0) {
+		usage(argv[0]);
+	}
+
+	struct timespec start_real, end_real;
+	clock_gettime(CLOCK_MONOTONIC, &start_real);
+	SimResult result;
+	sim_run(&config, &result);
+	clock_gettime(CLOCK_MONOTONIC, &end_real);
+	double real_ms = (end_real.tv_sec - start_real.tv_sec) * 1e3 +
+			(end_real.tv_nsec - start_real.tv_nsec) / 1e6;
+
+	const ControllerStats* stats = controller_stats();
+	double minutes = result.end_time / 60000.0;
+	printf("simulated %.0f s (%u floors, %u cars, %s traffic, %s, "
+			"%u ms per row) in %.1f ms\n", result.end_time / 1000.0,
+			NUM_FLOORS, NUM_CARS, traffic_pattern_name(config.pattern),
+			policy_names[config.policy], config.speed, real_ms);
+	printf("events %" PRIu64 ", steps run %" PRIu64 " of %" PRIu64 "\n",
+			result.events, result.steps, result.step_slots);
+	printf("calls %" PRIu32 " accepted, %" PRIu32 " rejected\n",
+			stats->calls, stats->rejected_calls);
+	printf("journeys %" PRIu32 " (%.2f per minute)\n", stats->journeys,
+			stats->journeys / minutes);
+	if (stats->journeys) {
+		printf("wait average %.2f s, max %.2f s; journey average %.2f s\n",
+				stats->total_wait / 1000.0 / stats->journeys,
+				stats->max_wait / 1000.0,
+				stats->total_journey / 1000.0 / stats->journeys);
+	}
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		const Car* car = controller_car(c);
+		printf("car %u: journeys %" PRIu32 ", average wait %.2f s, "
+				"floors %" PRIu32 " with and %" PRIu32 " without travellers\n",
+				c, car->journeys,
+				car->journeys ? car->total_wait / 1000.0 / car->journeys : 0.0,
+				car->floors_with_traveller, car->floors_without_traveller);
+	}
+	printf("door animations %" PRIu32 "%s, tunes %" PRIu32 " played, %"
+			PRIu32 " dropped\n", result.door_animations,
+			result.door_animating ? " (one running)" : "", result.tunes_played,
+			result.tunes_dropped);
+
+	sim_free_result(&result);
+	return 0;
+}
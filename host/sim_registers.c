@@ -0,0 +1,30 @@
+/*
+ * sim_registers.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Register memory for firmware modules linked into the simulator (which
+ * has no peripheral emulator). Nothing reacts to the registers and no
+ * interrupts are ever raised.
+ */
+
+#include <avr/io.h>
+
+#include "avr_host.h"
+
+volatile uint8_t host_reg[0x100];
+
+void host_sei(void) {
+	SREG |= _BV(SREG_I);
+}
+
+uint64_t host_time_us(void) {
+	return 0;
+}
+
+void host_delay_us(uint32_t us) {
+	(void)us;
+}
+
+void host_sleep(void) {
+}
@@ -0,0 +1,303 @@
+/*
+ * simulation.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Discrete-event simulation of the elevator emulator. The controller
+ * (controller.c, unchanged) is driven from a queue of timed events instead
+ * of the main loop and the millisecond timer, and the clock jumps straight
+ * from one event to the next:
+ * - car steps, every speed ms on the same grid as the step task in
+ *   start_elevator_emulator(). While the building is idle no steps are
+ *   scheduled - when the next call comes in, stepping resumes at the next
+ *   grid point, which is when the main loop would next have moved.
+ * - traveller arrivals (hall calls), from the traffic generator or a list
+ *   of calls. At the same time as a step they are handled after it, as in
+ *   the main loop (and as the firmware makes calls given a time by :C).
+ * - the end of the door LED animation and of each buzzer tune, so that
+ *   the animation restarts and tunes dropped by the buzzer queue are the
+ *   same as on the board.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "controller.h"
+#include "buzzer.h"
+#include "des.h"
+#include "simulation.h"
+
+// Event types, in the order they are handled when due at the same time
+enum {
+	EVENT_STEP,
+	EVENT_ARRIVE,
+	EVENT_DOOR_END,
+	EVENT_TONE_END,
+	EVENT_STOP
+};
+
+// Length of the door LED animation started on each pickup and drop off
+#define DOOR_ANIMATION_MS 1200
+
+// Sequences the buzzer can hold behind the one playing (as in buzzer.c)
+#define TUNE_QUEUE_SIZE 4
+
+static DesQueue queue;
+static SimResult* result;
+static uint32_t samples_capacity;
+
+static uint32_t step_period;	// speed ms
+static uint8_t stepping;		// a step event is in the queue
+
+static uint32_t door_generation;
+
+static uint8_t tune_playing;
+static uint8_t tunes_queued;
+static uint32_t tune_queue[TUNE_QUEUE_SIZE];	// lengths in ms
+
+static uint8_t trace;
+
+/* Buzzer */
+
+// Length of a tune in ms, rounded up
+static uint32_t tune_length(const Tone* tune) {
+	uint32_t ticks = 0;
+	for (; pgm_read_word(&tune->duration); tune++) {
+		ticks += pgm_read_word(&tune->duration);
+	}
+	return (ticks * 1024 + BUZZER_CPU_HZ / 1000 - 1) / (BUZZER_CPU_HZ / 1000);
+}
+
+static void play_tune(const Tone* tune) {
+	uint32_t length = tune_length(tune);
+	if (!tune_playing) {
+		tune_playing = 1;
+		result->tunes_played++;
+		des_schedule(&queue, queue.now + length, 0, EVENT_TONE_END, 0);
+	} else if (tunes_queued < TUNE_QUEUE_SIZE) {
+		tune_queue[tunes_queued++] = length;
+	} else {
+		result->tunes_dropped++;
+	}
+}
+
+static void tune_ended(void) {
+	if (tunes_queued) {
+		uint32_t length = tune_queue[0];
+		memmove(tune_queue, tune_queue + 1, --tunes_queued * sizeof(tune_queue[0]));
+		result->tunes_played++;
+		des_schedule(&queue, queue.now + length, 0, EVENT_TONE_END, 0);
+	} else {
+		tune_playing = 0;
+	}
+}
+
+/* Controller */
+
+static const char* const event_names[] = {
+	"call", "step", "arrive", "pickup", "dropoff"
+};
+
+static void add_sample(uint32_t** samples, uint32_t* count, uint32_t value) {
+	if (*count == samples_capacity) {
+		// Both arrays grow together (there are never more drop offs than
+		// pickups)
+		samples_capacity = samples_capacity ? samples_capacity * 2 : 1024;
+		result->waits = realloc(result->waits,
+				samples_capacity * sizeof(uint32_t));
+		result->journeys = realloc(result->journeys,
+				samples_capacity * sizeof(uint32_t));
+		if (!result->waits || !result->journeys) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	(*samples)[(*count)++] = value;
+}
+
+// Does the same as handle_controller_event() in the main program
+static void handle_controller_event(const ControllerEvent* event) {
+	if (trace && event->type != EVENT_CAR_STEP) {
+		printf("%10" PRIu64 " car %u %-8s floor %u", queue.now, event->car,
+				event_names[event->type], event->floor);
+		if (event->traveller) {
+			printf(" (%u to %u)", event->traveller->origin,
+					event->traveller->destination);
+		}
+		printf("\n");
+	}
+	switch (event->type) {
+		case EVENT_HALL_CALL:
+			play_tune(tune_chirp);
+			break;
+		case EVENT_PICKUP:
+		case EVENT_DROPOFF:
+			if (event->type == EVENT_PICKUP) {
+				add_sample(&result->waits, &result->num_waits,
+						event->time - event->traveller->call_time);
+			} else {
+				add_sample(&result->journeys, &result->num_journeys,
+						event->time - event->traveller->call_time);
+			}
+			play_tune(tune_arrival);
+			result->door_animating = 1;
+			result->door_animations++;
+			des_schedule(&queue, queue.now + DOOR_ANIMATION_MS, 0,
+					EVENT_DOOR_END, ++door_generation);
+			break;
+		default:
+			break;
+	}
+}
+
+// Nothing will change until the next call - every car is level with a
+// floor, stopped, and has nobody to carry or collect
+static uint8_t building_idle(void) {
+	if (controller_num_waiting()) {
+		return 0;
+	}
+	for (uint8_t c = 0; c < NUM_CARS; c++) {
+		const Car* car = controller_car(c);
+		if (car->num_riders || car->direction != DIRECTION_NONE ||
+				car->last_move != DIRECTION_NONE ||
+				car->position % FLOOR_HEIGHT != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void schedule_step(void) {
+	if (!stepping) {
+		stepping = 1;
+		uint64_t next = (queue.now / step_period + 1) * step_period;
+		des_schedule(&queue, next, EVENT_STEP, EVENT_STEP, 0);
+	}
+}
+
+void sim_default_config(SimConfig* config) {
+	config->duration_s = 3600;
+	config->calls_per_minute = 4;
+	config->seed = 1;
+	config->pattern = TRAFFIC_POISSON;
+	config->policy = POLICY_LOOK;
+	config->speed = 100;
+	config->trace = 0;
+	config->calls = 0;
+	config->num_calls = 0;
+}
+
+void sim_run(const SimConfig* config, SimResult* sim_result) {
+	result = sim_result;
+	memset(result, 0, sizeof(*result));
+	samples_capacity = 0;
+	stepping = 0;
+	door_generation = 0;
+	tune_playing = 0;
+	tunes_queued = 0;
+	trace = config->trace;
+
+	Traffic traffic;
+	traffic_init(&traffic, config->pattern, config->calls_per_minute,
+			config->seed);
+
+	des_init(&queue);
+	step_period = config->speed;
+	controller_init(0);
+	controller_set_policy(config->policy);
+	controller_set_event_handler(handle_controller_event);
+
+	result->end_time = (uint64_t)(config->duration_s * 1000);
+	result->step_slots = result->end_time / step_period;
+	// With a list of calls, each is an arrival event of its own (its data
+	// is its place in the list)
+	if (config->calls) {
+		for (uint32_t i = 0; i < config->num_calls; i++) {
+			des_schedule(&queue, config->calls[i].time, EVENT_ARRIVE,
+					EVENT_ARRIVE, i);
+		}
+	} else {
+		des_schedule(&queue, traffic_next_gap(&traffic), EVENT_ARRIVE,
+				EVENT_ARRIVE, 0);
+	}
+	des_schedule(&queue, result->end_time, EVENT_STOP, EVENT_STOP, 0);
+	// The main loop starts stepping straight away
+	schedule_step();
+
+	DesEvent event;
+	while (des_next(&queue, &event) && event.type != EVENT_STOP) {
+		switch (event.type) {
+			case EVENT_STEP:
+				stepping = 0;
+				controller_step(queue.now);
+				result->steps++;
+				if (!building_idle()) {
+					schedule_step();
+				}
+				break;
+			case EVENT_ARRIVE: {
+				uint8_t origin, destination;
+				if (config->calls) {
+					origin = config->calls[event.data].origin;
+					destination = config->calls[event.data].destination;
+				} else {
+					traffic_next_call(&traffic, &origin, &destination);
+					des_schedule(&queue, queue.now + traffic_next_gap(&traffic),
+							EVENT_ARRIVE, EVENT_ARRIVE, 0);
+				}
+				if (controller_hall_call(origin, destination, queue.now)) {
+					schedule_step();
+				} else {
+					play_tune(tune_error);
+				}
+				break;
+			}
+			case EVENT_DOOR_END:
+				if (event.data == door_generation) {
+					result->door_animating = 0;
+				}
+				break;
+			case EVENT_TONE_END:
+				tune_ended();
+				break;
+		}
+	}
+
+	result->events = queue.processed;
+	controller_set_event_handler(0);
+	des_free(&queue);
+}
+
+void sim_free_result(SimResult* sim_result) {
+	free(sim_result->waits);
+	free(sim_result->journeys);
+	sim_result->waits = 0;
+	sim_result->journeys = 0;
+	sim_result->num_waits = 0;
+	sim_result->num_journeys = 0;
+}
+
+static int compare_samples(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+uint32_t sim_percentile(uint32_t* samples, uint32_t count, double percent) {
+	if (!count) {
+		return 0;
+	}
+	qsort(samples, count, sizeof(samples[0]), compare_samples);
+	uint32_t rank = (uint32_t)ceil(percent / 100 * count);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > count) {
+		rank = count;
+	}
+	return samples[rank - 1];
+}
@@ -0,0 +1,69 @@
+/*
+ * simulation.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Runs the controller on a discrete-event clock (see simulation.c) with
+ * travellers from a traffic generator. Used by sim.c and bench.c.
+ */
+
+#ifndef SIMULATION_H_
+#define SIMULATION_H_
+
+#include <stdint.h>
+
+#include "controller.h"
+#include "traffic.h"
+
+// A traveller given to the simulation instead of coming from the traffic
+typedef struct {
+	uint64_t time;			// ms
+	uint8_t origin;
+	uint8_t destination;
+} SimCall;
+
+typedef struct {
+	double duration_s;
+	double calls_per_minute;
+	uint64_t seed;
+	TrafficPattern pattern;
+	DispatchPolicy policy;
+	uint32_t speed;			// ms per row, as set by the speed switch
+	uint8_t trace;			// print controller events to stdout
+	// If set, these travellers (in time order) and no others
+	const SimCall* calls;
+	uint32_t num_calls;
+} SimConfig;
+
+typedef struct {
+	uint64_t end_time;		// ms
+	uint64_t events;
+	uint64_t steps;
+	uint64_t step_slots;	// steps the main loop would have made
+	// Call to pickup and call to drop off times of each traveller, in ms
+	uint32_t* waits;
+	uint32_t num_waits;
+	uint32_t* journeys;
+	uint32_t num_journeys;
+	uint32_t door_animations;
+	uint8_t door_animating;
+	uint32_t tunes_played;
+	uint32_t tunes_dropped;
+} SimResult;
+
+/* Default configuration: an hour of Poisson traffic at 4 calls a minute
+ * under LOOK at the fast speed
+ */
+void sim_default_config(SimConfig* config);
+
+/* Run a simulation. The controller's own statistics (controller_stats()
+ * and controller_car()) are left as they were at the end.
+ */
+void sim_run(const SimConfig* config, SimResult* result);
+
+void sim_free_result(SimResult* result);
+
+/* Nearest-rank percentile (0-100) of samples, which get sorted */
+uint32_t sim_percentile(uint32_t* samples, uint32_t count, double percent);
+
+#endif /* SIMULATION_H_ */
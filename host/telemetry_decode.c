@@ -0,0 +1,282 @@
+/*
+ * telemetry_decode.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Turns the binary telemetry from the firmware (see telemetry.h) into CSV,
+ * one line per record, with a summary on standard error.
+ *
+ * Usage: telemetry_decode [-c] [-t] < serial_output > events.csv
+ *
+ * Replies to commands (TELEMETRY_REPLY records) go to standard error, a
+ * line at a time. Anything on the serial port that isn't a good frame (the
+ * text screen before telemetry was turned on) is skipped. After a gap in
+ * the sequence numbers the time is unknown (left empty) until the next
+ * sync record.
+ *
+ * With -c, the exit status is 1 if any frame was bad - for checking a
+ * stream that should be nothing but telemetry. With -t, the controller's
+ * calls, arrivals, pickups and drop offs are printed as sim -t prints them
+ * (see sim.c) instead of CSV, so that the two can be compared.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <util/crc16.h>
+
+#include "telemetry.h"
+
+// Longer runs of non-zero bytes can't be frames
+#define MAX_CHUNK 64
+
+// Longest reply line kept (the rest is cut off)
+#define MAX_REPLY 128
+
+static const char* const type_names[TELEMETRY_NUM_TYPES] = {
+	"sync", "step", "arrival", "hall_call", "pickup", "dropoff", "miss",
+	"reply"
+};
+
+// Values each type of record has after the time
+static const uint8_t type_values[TELEMETRY_NUM_TYPES] = { 1, 2, 2, 3, 5, 5, 2, 0 };
+
+typedef struct {
+	uint32_t time;
+	uint8_t time_known;
+	uint8_t expected_sequence;
+	uint8_t have_sequence;
+	unsigned long frames;
+	unsigned long bad;
+	unsigned long lost;
+	unsigned long dropped;	// frames the firmware couldn't send
+	char reply[MAX_REPLY + 1];
+	size_t reply_length;
+	int trace;				// -t
+} Decoder;
+
+// Undoes the COBS encoding. Returns the length, or 0 if it isn't valid.
+static size_t cobs_decode(const uint8_t* in, size_t length, uint8_t* out) {
+	size_t out_length = 0;
+	size_t i = 0;
+	while (i < length) {
+		uint8_t code = in[i++];
+		if (code == 0 || i + code - 1 > length) {
+			return 0;
+		}
+		for (uint8_t j = 1; j < code; j++) {
+			out[out_length++] = in[i++];
+		}
+		if (i < length) {
+			out[out_length++] = 0;
+		}
+	}
+	return out_length;
+}
+
+static int read_varint(const uint8_t** p, const uint8_t* end, uint32_t* value) {
+	*value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (*p >= end) {
+			return 0;
+		}
+		uint8_t byte = *(*p)++;
+		*value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Prints a value, or leaves the column empty
+static void print_column(int have, uint32_t value) {
+	if (have) {
+		printf(",%lu", (unsigned long)value);
+	} else {
+		printf(",");
+	}
+}
+
+// Follows the sequence numbers, counting the frames lost between them
+static void check_sequence(Decoder* decoder, uint8_t sequence) {
+	if (decoder->have_sequence && sequence != decoder->expected_sequence) {
+		decoder->lost += (uint8_t)(sequence - decoder->expected_sequence);
+		decoder->time_known = 0;
+	}
+	decoder->expected_sequence = sequence + 1;
+	decoder->have_sequence = 1;
+}
+
+// Adds the text of a reply record, printing each line as it is finished
+static void add_reply(Decoder* decoder, const uint8_t* text, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (text[i] == '\n') {
+			decoder->reply[decoder->reply_length] = 0;
+			fprintf(stderr, "reply: %s\n", decoder->reply);
+			decoder->reply_length = 0;
+		} else if (decoder->reply_length < MAX_REPLY) {
+			decoder->reply[decoder->reply_length++] = text[i];
+		}
+	}
+}
+
+// Prints a record as sim -t would (if it is one that prints)
+static void print_trace(const Decoder* decoder, uint8_t type,
+		const uint32_t* values) {
+	const char* name;
+	uint32_t floor = values[1];
+	int traveller = 1;
+	switch (type) {
+		case TELEMETRY_HALL_CALL:
+			name = "call";
+			floor = values[1];	// the origin
+			break;
+		case TELEMETRY_ARRIVAL:
+			name = "arrive";
+			traveller = 0;
+			break;
+		case TELEMETRY_PICKUP:
+			name = "pickup";
+			break;
+		case TELEMETRY_DROPOFF:
+			name = "dropoff";
+			break;
+		default:
+			return;
+	}
+	if (decoder->time_known) {
+		printf("%10lu", (unsigned long)decoder->time);
+	} else {
+		printf("%10s", "?");
+	}
+	printf(" car %lu %-8s floor %lu", (unsigned long)values[0], name,
+			(unsigned long)floor);
+	if (traveller) {
+		// Hall calls have no floor of their own before the origin
+		uint8_t first = type == TELEMETRY_HALL_CALL ? 1 : 2;
+		printf(" (%lu to %lu)", (unsigned long)values[first],
+				(unsigned long)values[first + 1]);
+	}
+	printf("\n");
+}
+
+static void decode_frame(Decoder* decoder, const uint8_t* chunk, size_t length) {
+	uint8_t record[MAX_CHUNK];
+	size_t record_length = cobs_decode(chunk, length, record);
+	if (record_length < 4) {
+		decoder->bad++;
+		return;
+	}
+	record_length -= 2;
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < record_length; i++) {
+		crc = _crc_ccitt_update(crc, record[i]);
+	}
+	if (crc != (record[record_length] | (record[record_length + 1] << 8))) {
+		decoder->bad++;
+		return;
+	}
+
+	uint8_t type = record[0];
+	uint8_t sequence = record[1];
+	const uint8_t* p = record + 2;
+	const uint8_t* end = record + record_length;
+	if (type == TELEMETRY_REPLY) {
+		decoder->frames++;
+		check_sequence(decoder, sequence);
+		add_reply(decoder, p, end - p);
+		return;
+	}
+	uint32_t time;
+	uint32_t values[5];
+	if (type >= TELEMETRY_NUM_TYPES || !read_varint(&p, end, &time)) {
+		decoder->bad++;
+		return;
+	}
+	for (uint8_t i = 0; i < type_values[type]; i++) {
+		if (!read_varint(&p, end, &values[i])) {
+			decoder->bad++;
+			return;
+		}
+	}
+	decoder->frames++;
+	check_sequence(decoder, sequence);
+	if (type == TELEMETRY_SYNC) {
+		decoder->time = time;
+		decoder->time_known = 1;
+		decoder->dropped = values[0];
+	} else {
+		// Zigzag encoded difference from the last record
+		decoder->time += (time >> 1) ^ -(time & 1);
+	}
+
+	if (decoder->trace) {
+		print_trace(decoder, type, values);
+		return;
+	}
+
+	// time_ms,seq,event,car,floor,origin,destination,position,duration_ms,task,dropped
+	if (decoder->time_known) {
+		printf("%lu", (unsigned long)decoder->time);
+	}
+	printf(",%u,%s", sequence, type_names[type]);
+	int traveller = type == TELEMETRY_PICKUP || type == TELEMETRY_DROPOFF;
+	int has_car = type != TELEMETRY_SYNC && type != TELEMETRY_MISS;
+	print_column(has_car, values[0]);
+	print_column(type == TELEMETRY_ARRIVAL || traveller, values[1]);
+	print_column(type == TELEMETRY_HALL_CALL || traveller,
+			type == TELEMETRY_HALL_CALL ? values[1] : values[2]);
+	print_column(type == TELEMETRY_HALL_CALL || traveller,
+			type == TELEMETRY_HALL_CALL ? values[2] : values[3]);
+	print_column(type == TELEMETRY_STEP, values[1]);
+	print_column(traveller || type == TELEMETRY_MISS,
+			type == TELEMETRY_MISS ? values[1] : values[4]);
+	print_column(type == TELEMETRY_MISS, values[0]);
+	print_column(type == TELEMETRY_SYNC, values[0]);
+	printf("\n");
+}
+
+int main(int argc, char** argv) {
+	Decoder decoder = { 0 };
+	int check = 0;
+	int option;
+	while ((option = getopt(argc, argv, "ct")) != -1) {
+		switch (option) {
+			case 'c': check = 1; break;
+			case 't': decoder.trace = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-c] [-t]\n", argv[0]);
+				return 2;
+		}
+	}
+	uint8_t chunk[MAX_CHUNK];
+	size_t length = 0;
+	int too_long = 0;
+	int c;
+
+	if (!decoder.trace) {
+		printf("time_ms,seq,event,car,floor,origin,destination,position,"
+				"duration_ms,task,dropped\n");
+	}
+	while ((c = getchar()) != EOF) {
+		if (c != 0) {
+			if (length < MAX_CHUNK) {
+				chunk[length++] = c;
+			} else {
+				too_long = 1;
+			}
+			continue;
+		}
+		// Long runs are text, not frames, so aren't counted as bad
+		if (length > 0 && !too_long) {
+			decode_frame(&decoder, chunk, length);
+		}
+		length = 0;
+		too_long = 0;
+	}
+
+	fprintf(stderr, "frames %lu, bad %lu, lost %lu, dropped by the firmware %lu\n",
+			decoder.frames, decoder.bad, decoder.lost, decoder.dropped);
+	return check && decoder.bad > 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * traffic.c
+ *
+ * Author: Lachlan Holliday
+ *
+ * Random numbers come from xorshift64*, so runs don't depend on the C
+ * library's rand(). The peak patterns send 85% of travellers to or from
+ * the ground floor and the rest between any two floors.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "controller.h"
+#include "traffic.h"
+
+// Share of peak travellers that start or end on the ground floor
+#define PEAK_SHARE 0.85
+
+// Group sizes for TRAFFIC_BURSTY are 2 to 6 (4 on average), arriving on
+// average this far apart
+#define BURST_MIN 2
+#define BURST_MAX 6
+#define BURST_GAP_MS 500.0
+
+static const char* const pattern_names[NUM_TRAFFIC_PATTERNS] = {
+	"poisson", "uniform", "up-peak", "down-peak", "lunch", "bursty"
+};
+
+static uint64_t random_next(Traffic* traffic) {
+	traffic->random_state ^= traffic->random_state >> 12;
+	traffic->random_state ^= traffic->random_state << 25;
+	traffic->random_state ^= traffic->random_state >> 27;
+	return traffic->random_state * 2685821657736338717ULL;
+}
+
+// Uniform on (0, 1)
+static double random_uniform(Traffic* traffic) {
+	return ((random_next(traffic) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static uint64_t random_exponential(Traffic* traffic, double mean) {
+	return (uint64_t)(-log(random_uniform(traffic)) * mean);
+}
+
+static uint8_t random_floor(Traffic* traffic, uint8_t lowest) {
+	return lowest + random_next(traffic) % (NUM_FLOORS - lowest);
+}
+
+void traffic_init(Traffic* traffic, TrafficPattern pattern,
+		double calls_per_minute, uint64_t seed) {
+	traffic->pattern = pattern;
+	// xorshift never leaves 0
+	traffic->random_state = seed ? seed : 1;
+	traffic->mean_gap_ms = 60000.0 / calls_per_minute;
+	traffic->burst_left = 0;
+	traffic->burst_origin = 0;
+}
+
+uint64_t traffic_next_gap(Traffic* traffic) {
+	switch (traffic->pattern) {
+		case TRAFFIC_UNIFORM:
+			return (uint64_t)traffic->mean_gap_ms;
+		case TRAFFIC_BURSTY:
+			if (traffic->burst_left) {
+				traffic->burst_left--;
+				return random_exponential(traffic, BURST_GAP_MS);
+			}
+			traffic->burst_left = BURST_MIN - 1 +
+					random_next(traffic) % (BURST_MAX - BURST_MIN + 1);
+			traffic->burst_origin = random_floor(traffic, 0);
+			// Groups come less often so the overall rate is the same
+			return random_exponential(traffic, traffic->mean_gap_ms *
+					(BURST_MIN + BURST_MAX) / 2);
+		default:
+			return random_exponential(traffic, traffic->mean_gap_ms);
+	}
+}
+
+void traffic_next_call(Traffic* traffic, uint8_t* origin,
+		uint8_t* destination) {
+	double share = random_uniform(traffic);
+	switch (traffic->pattern) {
+		case TRAFFIC_UP_PEAK:
+			if (share < PEAK_SHARE) {
+				*origin = 0;
+				*destination = random_floor(traffic, 1);
+				return;
+			}
+			break;
+		case TRAFFIC_DOWN_PEAK:
+			if (share < PEAK_SHARE) {
+				*origin = random_floor(traffic, 1);
+				*destination = 0;
+				return;
+			}
+			break;
+		case TRAFFIC_LUNCH:
+			if (share < PEAK_SHARE / 2) {
+				*origin = 0;
+				*destination = random_floor(traffic, 1);
+				return;
+			} else if (share < PEAK_SHARE) {
+				*origin = random_floor(traffic, 1);
+				*destination = 0;
+				return;
+			}
+			break;
+		case TRAFFIC_BURSTY:
+			*origin = traffic->burst_origin;
+			do {
+				*destination = random_floor(traffic, 0);
+			} while (*destination == *origin);
+			return;
+		default:
+			break;
+	}
+	*origin = random_floor(traffic, 0);
+	do {
+		*destination = random_floor(traffic, 0);
+	} while (*destination == *origin);
+}
+
+const char* traffic_pattern_name(TrafficPattern pattern) {
+	return pattern < NUM_TRAFFIC_PATTERNS ? pattern_names[pattern] : "?";
+}
+
+TrafficPattern traffic_pattern_named(const char* name) {
+	TrafficPattern pattern;
+	for (pattern = 0; pattern < NUM_TRAFFIC_PATTERNS; pattern++) {
+		if (!strcmp(name, pattern_names[pattern])) {
+			break;
+		}
+	}
+	return pattern;
+}
@@ -0,0 +1,49 @@
+/*
+ * traffic.h
+ *
+ * Author: Lachlan Holliday
+ *
+ * Seeded generators of simulated travellers. Each pattern decides both when
+ * the next traveller turns up and which floors they go between; the same
+ * seed always gives the same travellers.
+ */
+
+#ifndef TRAFFIC_H_
+#define TRAFFIC_H_
+
+#include <stdint.h>
+
+typedef enum {
+	TRAFFIC_POISSON,	// random arrivals, any floor to any floor
+	TRAFFIC_UNIFORM,	// evenly spaced arrivals, any floor to any floor
+	TRAFFIC_UP_PEAK,	// mostly from the ground floor up (start of day)
+	TRAFFIC_DOWN_PEAK,	// mostly down to the ground floor (end of day)
+	TRAFFIC_LUNCH,		// to and from the ground floor in equal measure
+	TRAFFIC_BURSTY,		// groups leaving one floor within a few seconds
+	NUM_TRAFFIC_PATTERNS
+} TrafficPattern;
+
+typedef struct {
+	TrafficPattern pattern;
+	uint64_t random_state;
+	double mean_gap_ms;		// between travellers, over the long run
+	uint8_t burst_left;		// travellers still to come in this group
+	uint8_t burst_origin;
+} Traffic;
+
+void traffic_init(Traffic* traffic, TrafficPattern pattern,
+		double calls_per_minute, uint64_t seed);
+
+/* Time from the last traveller to the next one, in ms */
+uint64_t traffic_next_gap(Traffic* traffic);
+
+/* Floors for the next traveller (always different) */
+void traffic_next_call(Traffic* traffic, uint8_t* origin,
+		uint8_t* destination);
+
+const char* traffic_pattern_name(TrafficPattern pattern);
+
+/* Pattern with the given name, or NUM_TRAFFIC_PATTERNS if there is none */
+TrafficPattern traffic_pattern_named(const char* name);
+
+#endif /* TRAFFIC_H_ */